@@ -2,65 +2,197 @@
 #include <fstream>
 #include <sstream>
 #include <cstring>
+#include <cerrno>
+#include <cmath>
 #include <mutex>
 #include <string>
 #include <regex>
-#include "HashTable.h"  
-#include "nlohmann/json.hpp"  
+#include <filesystem>
 #include <algorithm>
 #include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <random>
 #include <chrono>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#include <sys/socket.h>
+#include <sys/un.h>
 
 using namespace std;
-using json = nlohmann::json;
 namespace fs = std::filesystem;
 
-// Самописная структура для хранения вектора
+// Арена (bump-аллокатор): память нарезается из крупных блоков подряд,
+// отдельные выделения не освобождаются - все блоки отдаются разом
+struct Arena {
+    static constexpr size_t BLOCK_SIZE = 1 << 20;  // Размер обычного блока
+
+    Arena() : head(nullptr), pos(nullptr), end(nullptr), reserved(0) {}
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        release();
+    }
+
+    void* allocate(size_t bytes, size_t alignment) {
+        uintptr_t aligned = (reinterpret_cast<uintptr_t>(pos) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        if (!pos || aligned + bytes > reinterpret_cast<uintptr_t>(end)) {
+            add_block(bytes + alignment);
+            aligned = (reinterpret_cast<uintptr_t>(pos) + alignment - 1) & ~(uintptr_t)(alignment - 1);
+        }
+        pos = reinterpret_cast<char*>(aligned + bytes);
+        return reinterpret_cast<void*>(aligned);
+    }
+
+    // Освобождение всех блоков арены
+    void release() {
+        while (head) {
+            Block* next = head->next;
+            ::operator delete(head);
+            head = next;
+        }
+        pos = end = nullptr;
+        reserved = 0;
+    }
+
+    size_t reserved_bytes() const {  // Память, занятая блоками арены
+        return reserved;
+    }
+
+private:
+    struct Block {
+        Block* next;
+    };
+
+    void add_block(size_t min_bytes) {
+        size_t bytes = sizeof(Block) + (min_bytes > BLOCK_SIZE ? min_bytes : BLOCK_SIZE);
+        Block* block = static_cast<Block*>(::operator new(bytes));
+        block->next = head;
+        head = block;
+        pos = reinterpret_cast<char*>(block + 1);
+        end = reinterpret_cast<char*>(block) + bytes;
+        reserved += bytes;
+    }
+
+    Block* head;  // Последний выделенный блок (блоки связаны в список)
+    char* pos;  // Начало свободного места в текущем блоке
+    char* end;  // Конец текущего блока
+    size_t reserved;  // Суммарный размер блоков
+};
+
+// Самописная структура для хранения вектора. Память выделяется без
+// конструирования элементов, а при росте элементы перемещаются, а не копируются.
+// Вектор, созданный с ареной, берёт память из неё и не освобождает её сам
 template<typename T>
 struct CustVector {
     T* data;  // Указатель на данные
     size_t size;  // Текущий размер вектора
     size_t capacity;  // Вместимость вектора
+    Arena* arena;  // Арена для памяти элементов (nullptr - обычная куча)
 
-    CustVector() : data(nullptr), size(0), capacity(0) {}  // Конструктор по умолчанию
+    CustVector() : data(nullptr), size(0), capacity(0), arena(nullptr) {}  // Конструктор по умолчанию
 
-    CustVector(const CustVector& other) {  // Конструктор копирования
-        size = other.size;
-        capacity = other.capacity;
-        data = new T[capacity];
-        for (size_t i = 0; i < size; ++i) {
-            data[i] = other.data[i];
+    explicit CustVector(Arena* a) : data(nullptr), size(0), capacity(0), arena(a) {}  // Вектор в арене
+
+    CustVector(const CustVector& other) : data(nullptr), size(0), capacity(0), arena(nullptr) {  // Конструктор копирования
+        reserve(other.size);
+        for (size_t i = 0; i < other.size; ++i) {
+            new (data + i) T(other.data[i]);
+            ++size;
         }
     }
 
+    CustVector(CustVector&& other) noexcept  // Конструктор перемещения
+        : data(other.data), size(other.size), capacity(other.capacity), arena(other.arena) {
+        other.data = nullptr;
+        other.size = 0;
+        other.capacity = 0;
+    }
+
     CustVector& operator=(const CustVector& other) {  // Оператор присваивания
         if (this != &other) {
-            delete[] data;
-            size = other.size;
-            capacity = other.capacity;
-            data = new T[capacity];
-            for (size_t i = 0; i < size; ++i) {
-                data[i] = other.data[i];
-            }
+            CustVector copy(other);
+            swap(copy);
+        }
+        return *this;
+    }
+
+    CustVector& operator=(CustVector&& other) noexcept {  // Оператор перемещающего присваивания
+        if (this != &other) {
+            CustVector released(std::move(*this));
+            swap(other);
         }
         return *this;
     }
 
     ~CustVector() {  // Деструктор
-        delete[] data;
+        clear();
+        deallocate(data);
+    }
+
+    void swap(CustVector& other) noexcept {
+        std::swap(data, other.data);
+        std::swap(size, other.size);
+        std::swap(capacity, other.capacity);
+        std::swap(arena, other.arena);
+    }
+
+    // Резервирование памяти под new_capacity элементов
+    void reserve(size_t new_capacity) {
+        if (new_capacity <= capacity) {
+            return;
+        }
+        T* new_data = allocate(new_capacity);
+        relocate_to(new_data);
+        capacity = new_capacity;
     }
 
     void push_back(const T& value) {  // Добавление элемента в конец вектора
+        emplace_back(value);
+    }
+
+    void push_back(T&& value) {  // Добавление элемента перемещением
+        emplace_back(std::move(value));
+    }
+
+    // Конструирование элемента прямо в конце вектора
+    template<typename... Args>
+    T& emplace_back(Args&&... args) {
         if (size == capacity) {
-            capacity = capacity == 0 ? 1 : capacity * 2;
-            T* new_data = new T[capacity];
-            for (size_t i = 0; i < size; ++i) {
-                new_data[i] = data[i];
-            }
-            delete[] data;
-            data = new_data;
+            // Новый элемент создаётся до переноса старых: аргумент может ссылаться на элемент вектора
+            size_t new_capacity = capacity == 0 ? 1 : capacity * 2;
+            T* new_data = allocate(new_capacity);
+            new (new_data + size) T(std::forward<Args>(args)...);
+            relocate_to(new_data);
+            capacity = new_capacity;
+        } else {
+            new (data + size) T(std::forward<Args>(args)...);
+        }
+        return data[size++];
+    }
+
+    void pop_back() {  // Удаление последнего элемента
+        data[--size].~T();
+    }
+
+    void clear() {  // Удаление всех элементов с сохранением памяти
+        for (size_t i = 0; i < size; ++i) {
+            data[i].~T();
         }
-        data[size++] = value;
+        size = 0;
     }
 
     T& operator[](size_t index) {  // Оператор доступа по индексу
@@ -70,29 +202,186 @@ struct CustVector {
     const T& operator[](size_t index) const {  // Константный оператор доступа по индексу
         return data[index];
     }
+
+private:
+    T* allocate(size_t count) {
+        if (arena) {
+            return static_cast<T*>(arena->allocate(count * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(count * sizeof(T)));
+    }
+
+    void deallocate(T* memory) {
+        if (!arena) {
+            ::operator delete(memory);
+        }
+    }
+
+    // Перемещение элементов в новую память и освобождение старой
+    void relocate_to(T* new_data) {
+        for (size_t i = 0; i < size; ++i) {
+            new (new_data + i) T(std::move_if_noexcept(data[i]));
+            data[i].~T();
+        }
+        deallocate(data);
+        data = new_data;
+    }
+};
+
+// Признак отсутствия строки в индексах
+constexpr size_t NO_ROW = static_cast<size_t>(-1);
+
+// Словарь строк: каждой различной строке сопоставляется код
+struct StringDictionary {
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+    CustVector<string> values;  // Строки по кодам
+    CustVector<size_t> hashes;  // Хеши строк по кодам
+    CustVector<uint32_t> slots;  // Открытая адресация: код + 1, 0 - пустой слот
+
+    // Код строки или NOT_FOUND, если её нет в словаре
+    uint32_t find(const string& value) const {
+        if (slots.size == 0) return NOT_FOUND;
+        size_t h = std::hash<string>()(value);
+        size_t mask = slots.size - 1;
+        for (size_t i = h & mask; slots[i] != 0; i = (i + 1) & mask) {
+            uint32_t code = slots[i] - 1;
+            if (hashes[code] == h && values[code] == value) return code;
+        }
+        return NOT_FOUND;
+    }
+
+    // Код строки с добавлением в словарь при отсутствии
+    uint32_t intern(const string& value) {
+        if ((values.size + 1) * 2 > slots.size) {
+            grow();
+        }
+        size_t h = std::hash<string>()(value);
+        size_t mask = slots.size - 1;
+        size_t i = h & mask;
+        for (; slots[i] != 0; i = (i + 1) & mask) {
+            uint32_t code = slots[i] - 1;
+            if (hashes[code] == h && values[code] == value) return code;
+        }
+        uint32_t code = static_cast<uint32_t>(values.size);
+        values.push_back(value);
+        hashes.push_back(h);
+        slots[i] = code + 1;
+        return code;
+    }
+
+private:
+    void grow() {
+        size_t new_size = slots.size == 0 ? 16 : slots.size * 2;
+        CustVector<uint32_t> new_slots;
+        new_slots.reserve(new_size);
+        for (size_t i = 0; i < new_size; ++i) {
+            new_slots.push_back(0);
+        }
+        size_t mask = new_size - 1;
+        for (size_t code = 0; code < values.size; ++code) {
+            size_t i = hashes[code] & mask;
+            while (new_slots[i] != 0) i = (i + 1) & mask;
+            new_slots[i] = static_cast<uint32_t>(code + 1);
+        }
+        slots = std::move(new_slots);
+    }
+};
+
+// Тип столбца в колоночном представлении. Порядок - от самого узкого к самому общему
+enum ColumnType { COLUMN_INT, COLUMN_DOUBLE, COLUMN_STRING };
+
+// Столбец таблицы в виде непрерывного типизированного массива.
+// Строки таблицы остаются источником данных, колонки строятся по ним
+// при загрузке и используются при фильтрации
+struct TypedColumn {
+    ColumnType type;  // Тип столбца
+    CustVector<int64_t> ints;  // Значения COLUMN_INT
+    CustVector<double> doubles;  // Значения COLUMN_DOUBLE
+    CustVector<uint32_t> codes;  // Коды словаря COLUMN_STRING
+    StringDictionary dictionary;  // Словарь COLUMN_STRING
+
+    TypedColumn() : type(COLUMN_INT) {}
+};
+
+struct SecondaryIndex;
+struct Table;
+
+// Состояние файлов таблицы на диске в момент загрузки или последней своей записи.
+// Если оно не изменилось, таблица в памяти актуальна и перечитывать её не нужно
+struct FileStamp {
+    int64_t main_mtime;  // Время изменения основного файла (нс)
+    uint64_t main_size;  // Размер основного файла
+    uint64_t wal_size;  // Размер журнала вставок
+    uint64_t deleted_size;  // Размер журнала удалений
+
+    FileStamp() : main_mtime(0), main_size(0), wal_size(0), deleted_size(0) {}
+
+    bool operator==(const FileStamp& other) const {
+        return main_mtime == other.main_mtime && main_size == other.main_size &&
+               wal_size == other.wal_size && deleted_size == other.deleted_size;
+    }
+};
+
+// Сведения о таблице для кэша таблиц
+struct TableCacheInfo {
+    Table* prev;  // Соседняя таблица, использованная позже
+    Table* next;  // Соседняя таблица, использованная раньше
+    bool linked;  // Таблица в списке кэша
+    size_t bytes;  // Примерный объём памяти таблицы
+    size_t last_query;  // Номер последнего запроса, обращавшегося к таблице
+    FileStamp stamp;  // Состояние файлов, которому соответствует таблица
+
+    TableCacheInfo() : prev(nullptr), next(nullptr), linked(false), bytes(0), last_query(0) {}
 };
 
 // Структуры для хранения таблицы
 struct Table {
     string name;  // Имя таблицы
     CustVector<string> columns;  // Столбцы таблицы
+    Arena* arena;  // Арена для массивов ячеек строк (освобождается целиком)
     CustVector<CustVector<string>> rows;  // Строки таблицы
+    CustVector<string> column_types;  // Объявленные типы столбцов (пусто - выводятся при загрузке)
+    CustVector<TypedColumn> typed_columns;  // Колоночное представление строк
+    CustVector<size_t> pk_rows;  // Прямая адресация: значение первичного ключа -> номер строки
+    bool pk_index_valid;  // Можно ли пользоваться pk_rows (ключи целые, уникальные и плотные)
+    CustVector<SecondaryIndex*> indexes;  // Вторичные индексы (CREATE INDEX)
+    CustVector<uint64_t> deleted_bits;  // Битовая карта удалённых строк (пусто - удалений не было)
+    size_t deleted_rows;  // Число удалённых, но ещё не вычищенных строк
+    CustVector<uint8_t> loaded_columns;  // Столбцы, разобранные при загрузке (пусто - все); остальные ячейки пусты
     string primary_key;  // Первичный ключ
     string file_format; // Формат файла в котором хранится таблица
     size_t pk_sequence;  // Последовательность для первичного ключа
+    int wal_fd;  // Дескриптор журнала вставок (-1 если не открыт)
+    size_t wal_rows;  // Количество строк в журнале вставок
+    size_t wal_unsynced;  // Строки журнала, записанные после последнего fsync
+    size_t wal_torn_at;  // Начало недописанного хвоста журнала (SIZE_MAX - хвоста нет)
+    TableCacheInfo cache;  // Место таблицы в кэше (не копируется)
     mutex lock;  // Мьютекс для обеспечения потокобезопасности
 
-    Table(const string& n) : name(n), pk_sequence(0) {}  // Конструктор с именем таблицы
+    Table(const string& n) : name(n), arena(new Arena()), pk_index_valid(false), deleted_rows(0), pk_sequence(0), wal_fd(-1), wal_rows(0), wal_unsynced(0), wal_torn_at(SIZE_MAX) {}  // Конструктор с именем таблицы
 
     Table(const Table& other)  // Конструктор копирования
-        : name(other.name), columns(other.columns), rows(other.rows), primary_key(other.primary_key), pk_sequence(other.pk_sequence) {
+        : name(other.name), columns(other.columns), arena(new Arena()), rows(other.rows), column_types(other.column_types), typed_columns(other.typed_columns),
+          pk_rows(other.pk_rows), pk_index_valid(other.pk_index_valid), deleted_bits(other.deleted_bits),
+          deleted_rows(other.deleted_rows), loaded_columns(other.loaded_columns), primary_key(other.primary_key), pk_sequence(other.pk_sequence),
+          wal_fd(-1), wal_rows(other.wal_rows), wal_unsynced(0), wal_torn_at(other.wal_torn_at) {
     }
 
+    ~Table();
+
     Table& operator=(const Table& other) {  // Оператор присваивания
         if (this != &other) {
             name = other.name;
             columns = other.columns;
             rows = other.rows;
+            column_types = other.column_types;
+            typed_columns = other.typed_columns;
+            pk_rows = other.pk_rows;
+            pk_index_valid = other.pk_index_valid;
+            deleted_bits = other.deleted_bits;
+            deleted_rows = other.deleted_rows;
+            loaded_columns = other.loaded_columns;
             primary_key = other.primary_key;
             pk_sequence = other.pk_sequence;
         }
@@ -100,694 +389,4429 @@ struct Table {
     }
 };
 
-// Карта для хранения таблиц
-HashTable tables(10);  // Хеш-таблица для хранения таблиц
-
-string trim(const string& str) {
-    size_t first = str.find_first_not_of(" \t\n\r\f\v");
-    if (string::npos == first) {
-        return ""; // Возвращаем пустую строку если только пробельные символы
+// Кэш загруженных таблиц: список LRU и учёт занятой памяти. Когда объём
+// превышает бюджет, вытесняются давно не использованные таблицы, кроме тех,
+// к которым обращается текущий запрос
+class TableCache {
+public:
+    TableCache() : budget_bytes(0), query_id(0), head_(nullptr), tail_(nullptr), total_bytes_(0) {}
+
+    size_t budget_bytes;  // Бюджет памяти (0 - без ограничения)
+    size_t query_id;  // Номер выполняемого запроса
+
+    void add(Table* table) {
+        lock_guard<mutex> guard(lock_);
+        if (table->cache.linked) return;
+        table->cache.linked = true;
+        table->cache.last_query = query_id;
+        link_front(table);
+        total_bytes_ += table->cache.bytes;
     }
-    size_t last = str.find_last_not_of(" \t\n\r\f\v");
-    return str.substr(first, last - first + 1);
-}
 
-void lock_table(const string& data_dir, const string& table_name) {
-    fs::path lock_file_path = fs::path(data_dir) / (table_name + "_lock.txt");
-    ofstream lock_file(lock_file_path);
-    if (!lock_file.is_open()) {
-        cerr << "Failed to open lock file for writing: " << lock_file_path << endl;
-        return;
+    void remove(Table* table) {
+        lock_guard<mutex> guard(lock_);
+        if (!table->cache.linked) return;
+        unlink(table);
+        table->cache.linked = false;
+        total_bytes_ -= table->cache.bytes;
     }
-    lock_file << "lock";
-    lock_file.close();
-}
 
-void unlock_table(const string& data_dir, const string& table_name) {
-    fs::path lock_file_path = fs::path(data_dir) / (table_name + "_lock.txt");
-    ofstream lock_file(lock_file_path);
-    if (!lock_file.is_open()) {
-        cerr << "Failed to open lock file for writing: " << lock_file_path << endl;
-        return;
+    // Отметка об использовании: таблица переносится в начало списка
+    void touch(Table* table) {
+        lock_guard<mutex> guard(lock_);
+        table->cache.last_query = query_id;
+        if (!table->cache.linked || head_ == table) return;
+        unlink(table);
+        link_front(table);
     }
-    lock_file << "unlock";
-    lock_file.close();
-}
-
-void wait_for_unlock(const string& data_dir, const string& table_name) {
-    while (true) {
-        fs::path lock_file_path = fs::path(data_dir) / (table_name + "_lock.txt");
-        ifstream lock_file(lock_file_path);
-        if (!lock_file.is_open()) {
-            cerr << "Failed to open lock file for reading: " << lock_file_path << endl;
-            return;
-        }
-        string state;
-        getline(lock_file, state);
-        lock_file.close();
 
-        if (state == "unlock") {
-            lock_table(data_dir, table_name);
-            break;
+    // Новая оценка объёма памяти таблицы
+    void resize(Table* table, size_t bytes) {
+        lock_guard<mutex> guard(lock_);
+        if (table->cache.linked) {
+            total_bytes_ = total_bytes_ - table->cache.bytes + bytes;
         }
-
-        // Ждем немного перед следующей проверкой
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        table->cache.bytes = bytes;
     }
-}
 
-size_t read_pk_sequence(const string& data_dir, const string& table_name) {
-    fs::path pk_file_path = fs::path(data_dir) / (table_name + "_pk_sequence.txt");
-    ifstream pk_file(pk_file_path);
-    if (!pk_file.is_open()) {
-        cerr << "Failed to open pk_sequence file for reading: " << pk_file_path << endl;
-        return 0;
+    bool over_budget() const {
+        lock_guard<mutex> guard(lock_);
+        return budget_bytes > 0 && total_bytes_ > budget_bytes;
     }
-    size_t pk_sequence;
-    pk_file >> pk_sequence;
-    pk_file.close();
-    return pk_sequence;
-}
 
-void write_pk_sequence(const string& data_dir, const string& table_name, size_t pk_sequence) {
-    fs::path pk_file_path = fs::path(data_dir) / (table_name + "_pk_sequence.txt");
-    ofstream pk_file(pk_file_path);
-    if (!pk_file.is_open()) {
-        cerr << "Failed to open pk_sequence file for writing: " << pk_file_path << endl;
-        return;
+    // Давно не использованная таблица, которую можно вытеснить (nullptr - таких нет)
+    Table* eviction_candidate() const {
+        lock_guard<mutex> guard(lock_);
+        for (Table* table = tail_; table; table = table->cache.prev) {
+            if (table->cache.last_query != query_id) return table;
+        }
+        return nullptr;
     }
-    pk_file << pk_sequence;
-    pk_file.close();
-}
 
-void save_table_json(const string& data_dir, const Table& table) {
-    fs::path file_path = fs::path(data_dir) / (table.name + ".json");
-    ofstream file(file_path);
-    if (!file.is_open()) {
-        cout << "Failed to open file for writing: " << file_path << endl;
-        return;
+private:
+    void link_front(Table* table) {
+        table->cache.prev = nullptr;
+        table->cache.next = head_;
+        if (head_) head_->cache.prev = table;
+        head_ = table;
+        if (!tail_) tail_ = table;
     }
 
-    json j;
-    j["name"] = table.name;
-    j["columns"] = json::array();
-    for (size_t i = 0; i < table.columns.size; ++i) {
-        j["columns"].push_back(table.columns[i]);
+    void unlink(Table* table) {
+        if (table->cache.prev) table->cache.prev->cache.next = table->cache.next;
+        else head_ = table->cache.next;
+        if (table->cache.next) table->cache.next->cache.prev = table->cache.prev;
+        else tail_ = table->cache.prev;
+        table->cache.prev = table->cache.next = nullptr;
     }
-    j["rows"] = json::array();
-    for (size_t i = 0; i < table.rows.size; ++i) {
-        json row = json::array();
-        for (size_t j = 0; j < table.rows[i].size; ++j) {
-            row.push_back(table.rows[i][j]);
+
+    Table* head_;  // Последняя использованная таблица
+    Table* tail_;  // Дольше всех не использованная таблица
+    size_t total_bytes_;  // Суммарный объём таблиц в кэше
+    mutable mutex lock_;
+};
+
+TableCache table_cache;  // Кэш таблиц (бюджет задаётся --cache-mb)
+
+// Реестр загруженных таблиц: открытая адресация по схеме Robin Hood.
+// Реестр владеет таблицами: замена и удаление записи освобождают таблицу.
+// Хеш имени хранится в слоте, поэтому рост и сравнение не пересчитывают хеши.
+// Реестр однопоточный: запросы выполняются по одному, а рабочие потоки сканирования
+// к нему не обращаются. Указатель из get() действителен до ближайших put()/erase(),
+// в том числе до вытеснения таблицы из кэша
+class TableRegistry {
+public:
+    TableRegistry() : count_(0) {}
+    TableRegistry(const TableRegistry&) = delete;
+    TableRegistry& operator=(const TableRegistry&) = delete;
+
+    ~TableRegistry() {
+        for (size_t i = 0; i < slots_.size; ++i) {
+            delete slots_[i].table;
         }
-        j["rows"].push_back(row);
     }
-    j["primary_key"] = table.primary_key;
-    file << j.dump(4);
-}
 
-void load_table_json(const string& data_dir, const string& table_name) {
-    fs::path file_path = fs::path(data_dir) / (table_name + ".json");
-    ifstream file(file_path);
-    if (!file.is_open()) {
-        cout << "File not found: " << file_path << endl;
-        return;
+    static size_t hash_name(const string& name) {
+        return std::hash<string>()(name);
     }
 
-    json j;
-    file >> j;
+    Table* get(const string& name) const {
+        return get(name, hash_name(name));
+    }
 
-    Table* table_ptr = new Table(table_name);
-    for (const auto& col : j["columns"]) {
-        table_ptr->columns.push_back(col);
+    // Поиск по заранее вычисленному хешу имени
+    Table* get(const string& name, size_t hash) const {
+        size_t slot = find_slot(name, hash);
+        return slot == NO_ROW ? nullptr : slots_[slot].table;
     }
-    for (const auto& row : j["rows"]) {
-        CustVector<string> row_data;
-        for (const auto& val : row) {
-            row_data.push_back(val);
+
+    // Добавление или замена таблицы; прежняя таблица с тем же именем освобождается
+    void put(const string& name, Table* table) {
+        size_t hash = hash_name(name);
+        size_t slot = find_slot(name, hash);
+        if (slot != NO_ROW) {
+            if (slots_[slot].table != table) {
+                delete slots_[slot].table;
+                slots_[slot].table = table;
+                table_cache.add(table);
+            }
+            return;
         }
-        table_ptr->rows.push_back(row_data);
+        if ((count_ + 1) * 4 > slots_.size * 3) {
+            grow();
+        }
+        Slot entry;
+        entry.hash = hash;
+        entry.distance = 1;
+        entry.name = name;
+        entry.table = table;
+        insert_slot(std::move(entry));
+        ++count_;
+        table_cache.add(table);
     }
-    table_ptr->primary_key = j["primary_key"];
-    table_ptr->file_format = "json"; // Устанавливаем формат файла
-
-    tables.put(table_name, reinterpret_cast<void*>(table_ptr));
-}
 
-// Загрузка таблицы из CSV с указанием директории
-void load_table_csv(const string& data_dir, const string& table_name) {
-    fs::path file_path = fs::path(data_dir) / (table_name + ".csv");
-    ifstream file(file_path);
-    if (!file.is_open()) {
-        cout << "File not found: " << file_path << endl;
-        return;
+    // Удаление таблицы из реестра с освобождением памяти (вытеснение)
+    bool erase(const string& name) {
+        size_t slot = find_slot(name, hash_name(name));
+        if (slot == NO_ROW) {
+            return false;
+        }
+        delete slots_[slot].table;
+        // Обратный сдвиг: следующие записи цепочки встают ближе к своим бакетам
+        size_t mask = slots_.size - 1;
+        size_t next = (slot + 1) & mask;
+        while (slots_[next].distance > 1) {
+            slots_[slot] = std::move(slots_[next]);
+            slots_[slot].distance--;
+            slot = next;
+            next = (next + 1) & mask;
+        }
+        slots_[slot] = Slot();
+        --count_;
+        return true;
     }
 
-    Table* table_ptr = new Table(table_name);
-    string line;
-    bool first_line = true;
-    bool has_primary_key_info = false;
-    string primary_key_from_csv;
+    size_t size() const {
+        return count_;
+    }
 
-    while (getline(file, line)) {
-        istringstream iss(line);
-        string value;
-        CustVector<string> row;
+private:
+    struct Slot {
+        size_t hash;  // Хеш имени
+        size_t distance;  // Расстояние от своего бакета + 1 (0 - слот пуст)
+        string name;  // Имя таблицы
+        Table* table;  // Таблица
+
+        Slot() : hash(0), distance(0), table(nullptr) {}
+    };
+
+    size_t find_slot(const string& name, size_t hash) const {
+        if (slots_.size == 0) return NO_ROW;
+        size_t mask = slots_.size - 1;
+        size_t slot = hash & mask;
+        // Запись не может стоять дальше от своего бакета, чем встреченная на пути
+        for (size_t distance = 1; slots_[slot].distance >= distance; ++distance) {
+            if (slots_[slot].hash == hash && slots_[slot].name == name) {
+                return slot;
+            }
+            slot = (slot + 1) & mask;
+        }
+        return NO_ROW;
+    }
 
-        while (getline(iss, value, ',')) {
-            if (value.front() == '"' && value.back() == '"') {
-                value = value.substr(1, value.size() - 2);
-            }
-            row.push_back(value);
-        }
-
-        if (first_line) {
-            // Проверяем, есть ли информация о первичном ключе в последнем элементе
-            if (row.size > 0) {
-                string last_column = row[row.size - 1];
-                if (last_column.find("PRIMARY_KEY:") == 0) {
-                    // Извлекаем первичный ключ
-                    primary_key_from_csv = last_column.substr(12);
-                    has_primary_key_info = true;
-                    // Удаляем информацию о PK из столбцов
-                    CustVector<string> cleaned_columns;
-                    for (size_t i = 0; i < row.size - 1; ++i) {
-                        cleaned_columns.push_back(row[i]);
-                    }
-                    table_ptr->columns = cleaned_columns;
-                } else {
-                    table_ptr->columns = row;
-                }
+    // Вставка с вытеснением записей, которые ближе к своему бакету, чем вставляемая
+    void insert_slot(Slot entry) {
+        size_t mask = slots_.size - 1;
+        size_t slot = entry.hash & mask;
+        while (slots_[slot].distance != 0) {
+            if (slots_[slot].distance < entry.distance) {
+                std::swap(slots_[slot], entry);
             }
-            first_line = false;
+            slot = (slot + 1) & mask;
+            entry.distance++;
         }
-        else {
-            table_ptr->rows.push_back(row);
+        slots_[slot] = std::move(entry);
+    }
+
+    void grow() {
+        CustVector<Slot> old_slots = std::move(slots_);
+        size_t new_size = old_slots.size == 0 ? 16 : old_slots.size * 2;
+        slots_ = CustVector<Slot>();
+        slots_.reserve(new_size);
+        for (size_t i = 0; i < new_size; ++i) {
+            slots_.emplace_back();
+        }
+        for (size_t i = 0; i < old_slots.size; ++i) {
+            if (old_slots[i].distance != 0) {
+                old_slots[i].distance = 1;
+                insert_slot(std::move(old_slots[i]));
+            }
         }
     }
 
-    // Устанавливаем первичный ключ
-    if (has_primary_key_info) {
-        table_ptr->primary_key = primary_key_from_csv;
-    } else {
-        // По умолчанию первым столбцом является ID
-        table_ptr->primary_key = "ID";
+    CustVector<Slot> slots_;  // Слоты, размер - степень двойки
+    size_t count_;  // Число таблиц
+};
+
+TableRegistry tables;  // Загруженные таблицы
+
+// Хеш-индекс по одному столбцу таблицы. Строки с одинаковым бакетом
+// связаны в цепочки через массив next, поэтому построение выполняется за O(N)
+// без выделения памяти под каждую запись. Цепочка кольцевая: бакет хранит
+// последнюю строку, а её next - первую, так что дописывание в хвост стоит O(1)
+struct HashIndex {
+    const Table* table;  // Таблица, по которой построен индекс
+    size_t column;  // Индекс столбца
+    size_t mask;  // Маска для вычисления номера бакета
+    CustVector<size_t> buckets;  // Последняя строка цепочки для каждого бакета
+    CustVector<size_t> next;  // Следующая строка в цепочке (у последней - первая)
+    CustVector<size_t> hashes;  // Хеши значений каждой строки
+
+    HashIndex() : table(nullptr), column(0), mask(0) {}
+
+    void build(const Table* t, size_t col) {
+        table = t;
+        column = col;
+        hashes = CustVector<size_t>();
+        next = CustVector<size_t>();
+        hashes.reserve(t->rows.size);
+        next.reserve(t->rows.size);
+        for (size_t i = 0; i < t->rows.size; ++i) {
+            hashes.push_back(std::hash<string>()(t->rows[i][col]));
+            next.push_back(NO_ROW);
+        }
+        relink();
     }
 
-    // Проверяем и корректируем индексы (должны начинаться с 1)
-    for (size_t i = 0; i < table_ptr->rows.size; ++i) {
-        if (table_ptr->rows[i].size > 0) {
-            try {
-                int current_id = stoi(table_ptr->rows[i][0]);
-                if (current_id == 0) {
-                    // Если ID = 0, меняем на i+1
-                    table_ptr->rows[i][0] = to_string(i + 1);
-                }
-            } catch (...) {
-                // Если не число, устанавливаем правильный ID
-                table_ptr->rows[i][0] = to_string(i + 1);
-            }
+    // Добавление строки, дописанной в конец таблицы
+    void insert(size_t row) {
+        hashes.push_back(std::hash<string>()(table->rows[row][column]));
+        next.push_back(NO_ROW);
+        if (hashes.size * 2 > buckets.size) {
+            relink();
+            return;
         }
+        link(row);
     }
 
-    table_ptr->file_format = "csv"; // Устанавливаем формат файла
-    tables.put(table_name, reinterpret_cast<void*>(table_ptr));
-}
+    // Первая строка, значение которой равно key
+    size_t find(const string& key) const {
+        if (buckets.size == 0) return NO_ROW;
+        size_t h = std::hash<string>()(key);
+        size_t tail = buckets[h & mask];
+        return tail == NO_ROW ? NO_ROW : skip_to_match(next[tail], h, key);
+    }
 
-void load_table(const string& data_dir, const string& table_name) {
-    fs::path json_path = fs::path(data_dir) / (table_name + ".json");
-    fs::path csv_path = fs::path(data_dir) / (table_name + ".csv");
+    // Следующая после row строка с тем же значением
+    size_t next_match(size_t row, const string& key) const {
+        return row == buckets[hashes[row] & mask] ? NO_ROW : skip_to_match(next[row], hashes[row], key);
+    }
 
-    bool json_exists = fs::exists(json_path);
-    bool csv_exists = fs::exists(csv_path);
+private:
+    // Перераспределение всех строк по бакетам (размер - степень двойки не меньше 2N)
+    void relink() {
+        size_t bucket_count = 1;
+        while (bucket_count < hashes.size * 2) {
+            bucket_count <<= 1;
+        }
+        mask = bucket_count - 1;
+        buckets = CustVector<size_t>();
+        buckets.reserve(bucket_count);
+        for (size_t i = 0; i < bucket_count; ++i) {
+            buckets.push_back(NO_ROW);
+        }
+        for (size_t i = 0; i < hashes.size; ++i) {
+            link(i);
+        }
+    }
 
-    if (json_exists && csv_exists) {
-        cout << "Error: Both JSON and CSV files exist for table '" << table_name << "'" << endl;
-        return;
+    // Дописывание строки в хвост её цепочки: цепочки идут в порядке возрастания номеров строк
+    void link(size_t row) {
+        size_t bucket = hashes[row] & mask;
+        size_t tail = buckets[bucket];
+        if (tail == NO_ROW) {
+            next[row] = row;
+        } else {
+            next[row] = next[tail];
+            next[tail] = row;
+        }
+        buckets[bucket] = row;
     }
 
-    if (json_exists) {
-        load_table_json(data_dir, table_name);
+    // Первая, начиная с row, строка цепочки со значением key (до конца цепочки)
+    size_t skip_to_match(size_t row, size_t h, const string& key) const {
+        size_t tail = buckets[h & mask];
+        while (hashes[row] != h || table->rows[row][column] != key) {
+            if (row == tail) return NO_ROW;
+            row = next[row];
+        }
+        return row;
     }
-    else if (csv_exists) {
-        load_table_csv(data_dir, table_name);
+};
+
+// Вторичный индекс, созданный командой CREATE INDEX
+struct SecondaryIndex {
+    string name;  // Имя индекса
+    size_t column;  // Индекс столбца
+    bool sorted;  // Упорядоченный индекс (иначе хеш-индекс)
+    ColumnType key_type;  // Тип колонки, по которому упорядочены строки
+    HashIndex hash;  // Данные хеш-индекса
+    CustVector<size_t> order;  // Номера строк по возрастанию значения (упорядоченный индекс)
+    CustVector<size_t> pending;  // Вставленные строки, ещё не влитые в order
+
+    SecondaryIndex() : column(0), sorted(false), key_type(COLUMN_STRING) {}
+};
+
+Table::~Table() {
+    table_cache.remove(this);
+    // Строки ссылаются на память арены, поэтому уничтожаются раньше неё
+    rows = CustVector<CustVector<string>>();
+    delete arena;
+    if (wal_fd >= 0) {
+        close(wal_fd);
     }
-    else {
-        cerr << "Error: No table file found for '" << table_name << "' in directory '" << data_dir << "'" << endl;
-        return;
+    for (size_t i = 0; i < indexes.size; ++i) {
+        delete indexes[i];
     }
 }
 
+// Новая пустая строка в конце таблицы. Массив ячеек берётся из арены таблицы
+// и сразу резервируется под все столбцы, чтобы рост не оставлял в арене пустых кусков
+CustVector<string>& append_row(Table* table) {
+    CustVector<string>& row = table->rows.emplace_back(table->arena);
+    row.reserve(table->columns.size);
+    return row;
+}
 
-void save_table_csv(const string& data_dir, const Table& table) {
-    fs::path file_path = fs::path(data_dir) / (table.name + ".csv");
-    ofstream file(file_path);
-    if (!file.is_open()) {
-        cout << "Failed to open file for writing: " << file_path << endl;
-        return;
+// Перенос строк, не вошедших в removed (номера по возрастанию), в новую арену.
+// Старая арена вместе с удалёнными строками освобождается целиком
+void rebuild_rows(Table* table, const CustVector<size_t>& removed) {
+    Arena* new_arena = new Arena();
+    CustVector<CustVector<string>> new_rows;
+    new_rows.reserve(table->rows.size - removed.size);
+    size_t next_removed = 0;
+    for (size_t i = 0; i < table->rows.size; ++i) {
+        if (next_removed < removed.size && removed[next_removed] == i) {
+            ++next_removed;
+            continue;
+        }
+        CustVector<string>& old_row = table->rows[i];
+        CustVector<string>& row = new_rows.emplace_back(new_arena);
+        row.reserve(old_row.size);
+        for (size_t j = 0; j < old_row.size; ++j) {
+            row.push_back(std::move(old_row[j]));
+        }
     }
+    table->rows = std::move(new_rows);
+    delete table->arena;
+    table->arena = new_arena;
+}
 
-    // Запись заголовков с информацией о первичном ключе в конце
-    for (size_t i = 0; i < table.columns.size; ++i) {
-        file << "\"" << table.columns[i] << "\"";
-        if (i < table.columns.size - 1) file << ",";
+// Строка помечена удалённой и пропускается при просмотре
+inline bool row_deleted(const Table* table, size_t row) {
+    size_t word = row >> 6;
+    return word < table->deleted_bits.size && ((table->deleted_bits[word] >> (row & 63)) & 1);
+}
+
+// Память, занятая значением ячейки вне самого объекта string (короткие строки хранятся внутри)
+inline size_t cell_heap_bytes(const string& value) {
+    return value.capacity() > 15 ? value.capacity() + 1 : 0;
+}
+
+// Примерный объём памяти одной строки, которая не лежит в арене
+size_t estimate_row_bytes(const Table* table, const CustVector<string>& row) {
+    size_t bytes = sizeof(row);
+    if (row.arena != table->arena) {
+        bytes += row.capacity * sizeof(string);
     }
-    // Добавляем информацию о первичном ключе в конец первой строки
-    file << ",\"PRIMARY_KEY:" << table.primary_key << "\"";
-    file << endl;
+    for (size_t j = 0; j < row.size; ++j) {
+        bytes += cell_heap_bytes(row[j]);
+    }
+    return bytes;
+}
 
-    // Запись данных
-    for (size_t i = 0; i < table.rows.size; ++i) {
-        for (size_t j = 0; j < table.rows[i].size; ++j) {
-            file << "\"" << table.rows[i][j] << "\"";
-            if (j < table.rows[i].size - 1) {
-                file << ",";
-            }
+// Примерный объём памяти таблицы: арена, длинные значения, колонки и индексы
+size_t estimate_table_bytes(const Table* table) {
+    size_t bytes = sizeof(Table) + table->arena->reserved_bytes();
+    bytes += (table->rows.capacity - table->rows.size) * sizeof(CustVector<string>);
+    for (size_t i = 0; i < table->rows.size; ++i) {
+        bytes += estimate_row_bytes(table, table->rows[i]);
+    }
+    for (size_t col = 0; col < table->typed_columns.size; ++col) {
+        const TypedColumn& column = table->typed_columns[col];
+        bytes += column.ints.capacity * sizeof(int64_t) + column.doubles.capacity * sizeof(double) +
+                 column.codes.capacity * sizeof(uint32_t) + column.dictionary.slots.capacity * sizeof(uint32_t) +
+                 column.dictionary.hashes.capacity * sizeof(size_t) + column.dictionary.values.capacity * sizeof(string);
+        for (size_t k = 0; k < column.dictionary.values.size; ++k) {
+            bytes += cell_heap_bytes(column.dictionary.values[k]);
         }
-        file << endl;
     }
-    cout << "Table saved to " << file_path << endl;
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        const SecondaryIndex* index = table->indexes[i];
+        bytes += (index->hash.buckets.capacity + index->hash.next.capacity + index->hash.hashes.capacity +
+                  index->order.capacity + index->pending.capacity) * sizeof(size_t);
+    }
+    bytes += table->pk_rows.capacity * sizeof(size_t) + table->deleted_bits.capacity * sizeof(uint64_t);
+    return bytes;
 }
 
-// Сохранить таблицу в CSV формате (удаляя JSON если был)
-void save_as_csv(const string& data_dir, const string& table_name, const Table& table) {
-    fs::path json_path = fs::path(data_dir) / (table_name + ".json");
-    fs::path csv_path = fs::path(data_dir) / (table_name + ".csv");
-    
-    // Если уже в CSV - ничего не делаем
-    if (fs::exists(csv_path) && !fs::exists(json_path)) {
-        cout << "Table is already in CSV format: " << csv_path << endl;
-        return;
+void mark_row_deleted(Table* table, size_t row) {
+    while (table->deleted_bits.size <= (row >> 6)) {
+        table->deleted_bits.push_back(0);
     }
-    wait_for_unlock(data_dir, table_name);
-    
-    // Удаляем старый JSON файл если существует
-    if (fs::exists(json_path)) {
-        fs::remove(json_path);
-        cout << "Removed JSON file: " << json_path << endl;
+    if (!row_deleted(table, row)) {
+        table->deleted_bits[row >> 6] |= uint64_t(1) << (row & 63);
+        table->deleted_rows++;
     }
-    
-    // Сохраняем в CSV
-    save_table_csv(data_dir, table);
-    unlock_table(data_dir, table_name);
-    cout << "Table saved as CSV: " << csv_path << endl;
 }
 
-// Сохранить таблицу в JSON формате (удаляя CSV если был)
-void save_as_json(const string& data_dir, const string& table_name, const Table& table) {
-    fs::path json_path = fs::path(data_dir) / (table_name + ".json");
-    fs::path csv_path = fs::path(data_dir) / (table_name + ".csv");
-    
-    // Если уже в JSON - ничего не делаем
-    if (fs::exists(json_path) && !fs::exists(csv_path)) {
-        cout << "Table is already in JSON format: " << json_path << endl;
+// Порядок чисел для сортировки и индексов: NaN после всех чисел. Обычное "<" с NaN
+// не задаёт строгого слабого порядка, и sort или бинарный поиск на нём ломаются
+inline bool double_less(double a, double b) {
+    return a < b || (std::isnan(b) && !std::isnan(a));
+}
+
+// Сравнение значений двух строк по столбцу упорядоченного индекса
+bool index_key_less(const Table* table, const SecondaryIndex* index, size_t a, size_t b) {
+    const TypedColumn& column = table->typed_columns[index->column];
+    if (index->key_type == COLUMN_INT) return column.ints[a] < column.ints[b];
+    if (index->key_type == COLUMN_DOUBLE) return double_less(column.doubles[a], column.doubles[b]);
+    return table->rows[a][index->column] < table->rows[b][index->column];
+}
+
+// Построение индекса по всем строкам таблицы
+void build_secondary_index(const Table* table, SecondaryIndex* index) {
+    if (!index->sorted) {
+        index->hash.build(table, index->column);
         return;
     }
-    wait_for_unlock(data_dir, table_name);
-    
-    // Удаляем старый CSV файл если существует
-    if (fs::exists(csv_path)) {
-        fs::remove(csv_path);
-        cout << "Removed CSV file: " << csv_path << endl;
+    index->key_type = table->typed_columns[index->column].type;
+    index->pending = CustVector<size_t>();
+    index->order = CustVector<size_t>();
+    index->order.reserve(table->rows.size);
+    for (size_t i = 0; i < table->rows.size; ++i) {
+        index->order.push_back(i);
     }
-    
-    // Сохраняем в JSON
-    save_table_json(data_dir, table);
-    unlock_table(data_dir, table_name);
-    cout << "Table saved as JSON: " << json_path << endl;
+    stable_sort(index->order.data, index->order.data + index->order.size,
+                [table, index](size_t a, size_t b) { return index_key_less(table, index, a, b); });
 }
 
-// Функция для сохранения последовательности первичных ключей
-void save_pk_sequence(const Table& table) {
-    ofstream file(table.name + "_pk_sequence.txt");
+// Перестроение всех индексов таблицы (после удаления строк номера сдвигаются)
+void build_secondary_indexes(Table* table) {
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        build_secondary_index(table, table->indexes[i]);
+    }
+}
+
+// Вставленные строки копятся в буфере упорядоченного индекса и вливаются в order,
+// когда буфер дорастает до 1/INDEX_PENDING_DIVISOR индекса (но не раньше INDEX_PENDING_MIN):
+// слияние стоит O(N), поэтому на одну вставленную строку приходится O(1) его стоимости.
+// Запрос по индексу проверяет строки буфера наравне с найденными в order
+const size_t INDEX_PENDING_MIN = 256;
+const size_t INDEX_PENDING_DIVISOR = 64;
+
+// Слияние буфера вставленных строк с order. Буфер сортируется, затем вливается с конца
+// на месте: место каждой строки находится бинарным поиском, а сдвигаются только элементы
+// правее первой вставки - O(N + k log N). upper_bound ставит новую строку после старых
+// с равным ключом: у неё больший номер
+void merge_pending_rows(const Table* table, SecondaryIndex* index) {
+    auto less = [table, index](size_t a, size_t b) { return index_key_less(table, index, a, b); };
+    CustVector<size_t>& added = index->pending;
+    stable_sort(added.data, added.data + added.size, less);
+
+    size_t a = index->order.size;
+    for (size_t k = 0; k < added.size; ++k) {
+        index->order.push_back(0);
+    }
+    size_t* order = index->order.data;
+    for (size_t b = added.size; b > 0; --b) {
+        size_t position = upper_bound(order, order + a, added[b - 1], less) - order;
+        move_backward(order + position, order + a, order + a + b);
+        order[position + b - 1] = added[b - 1];
+        a = position;
+    }
+    added.clear();
+}
+
+// Добавление в индексы строк, дописанных в конец таблицы (с first_row до конца).
+// В хеш-индекс строки добавляются по одной за O(1), в упорядоченный - через буфер
+void add_rows_to_indexes(Table* table, size_t first_row) {
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        SecondaryIndex* index = table->indexes[i];
+        if (!index->sorted) {
+            for (size_t row = first_row; row < table->rows.size; ++row) {
+                index->hash.insert(row);
+            }
+            continue;
+        }
+        if (index->key_type != table->typed_columns[index->column].type) {
+            // Тип колонки расширился - порядок значений изменился
+            build_secondary_index(table, index);
+            continue;
+        }
+        for (size_t row = first_row; row < table->rows.size; ++row) {
+            index->pending.push_back(row);
+        }
+        if (index->pending.size >= max(INDEX_PENDING_MIN, index->order.size / INDEX_PENDING_DIVISOR)) {
+            merge_pending_rows(table, index);
+        }
+    }
+}
+
+fs::path index_definitions_path(const string& data_dir, const string& table_name) {
+    return fs::path(data_dir) / (table_name + "_indexes.txt");
+}
+
+// Определения индексов хранятся рядом с таблицей: "имя столбец HASH|SORTED" на строку.
+// Сами индексы строятся заново при загрузке таблицы
+void save_index_definitions(const string& data_dir, const Table* table) {
+    ofstream file(index_definitions_path(data_dir, table->name));
     if (!file.is_open()) {
-        cout << "Failed to open file for writing pk_sequence." << endl;
+        cerr << "Failed to open index file for writing: " << index_definitions_path(data_dir, table->name) << endl;
         return;
     }
-    file << table.pk_sequence;
-    cout << "Primary key sequence saved to " << table.name << "_pk_sequence.txt" << endl;
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        const SecondaryIndex* index = table->indexes[i];
+        file << index->name << " " << table->columns[index->column] << " " << (index->sorted ? "SORTED" : "HASH") << "\n";
+    }
 }
 
-// Функция для загрузки последовательности первичных ключей
-void load_pk_sequence(Table& table) {
-    ifstream file(table.name + "_pk_sequence.txt");
+void load_index_definitions(const string& data_dir, Table* table) {
+    ifstream file(index_definitions_path(data_dir, table->name));
     if (!file.is_open()) {
-        cout << "File not found for pk_sequence." << endl;
         return;
     }
-    file >> table.pk_sequence;
-    cout << "Primary key sequence loaded from " << table.name << "_pk_sequence.txt" << endl;
+    string index_name;
+    string column_name;
+    string kind;
+    while (file >> index_name >> column_name >> kind) {
+        for (size_t col = 0; col < table->columns.size; ++col) {
+            if (table->columns[col] == column_name) {
+                SecondaryIndex* index = new SecondaryIndex();
+                index->name = index_name;
+                index->column = col;
+                index->sorted = kind == "SORTED";
+                build_secondary_index(table, index);
+                table->indexes.push_back(index);
+                break;
+            }
+        }
+    }
 }
 
-// Вспомогательная функция для добавления уникальной колонки
-void add_column_if_unique(const string& column, CustVector<string>& columns) {
-    if (column.empty() || column == "ID") {
-        return;
+// Разобран ли столбец при загрузке таблицы
+inline bool column_loaded(const Table* table, size_t col) {
+    return table->loaded_columns.size == 0 || (col < table->loaded_columns.size && table->loaded_columns[col]);
+}
+
+// Маска столбцов, которые загрузчик разбирает (пусто - все). Кроме названных запросом
+// всегда разбираются первичный ключ, первый столбец (по нему загрузчик CSV проверяет
+// номера строк) и столбцы вторичных индексов, которые строятся при загрузке
+CustVector<uint8_t> projection_mask(const string& data_dir, const Table* table, const CustVector<string>* needed) {
+    CustVector<uint8_t> mask;
+    if (!needed || table->columns.size == 0) {
+        return mask;
     }
-    
-    // Проверяем уникальность (без unordered_set)
-    for (size_t i = 0; i < columns.size; ++i) {
-        if (columns[i] == column) {
-            return; // Колонка уже существует
+    CustVector<string> index_columns;
+    ifstream file(index_definitions_path(data_dir, table->name));
+    string index_name;
+    string column_name;
+    string kind;
+    while (file >> index_name >> column_name >> kind) {
+        index_columns.push_back(column_name);
+    }
+
+    bool all = true;
+    for (size_t col = 0; col < table->columns.size; ++col) {
+        const string& name = table->columns[col];
+        bool keep = col == 0 || name == table->primary_key;
+        for (size_t i = 0; i < needed->size && !keep; ++i) {
+            keep = (*needed)[i] == name;
         }
+        for (size_t i = 0; i < index_columns.size && !keep; ++i) {
+            keep = index_columns[i] == name;
+        }
+        mask.push_back(keep);
+        all = all && keep;
     }
-    
-    // Добавляем если уникальна
-    columns.push_back(column);
+    if (all) {
+        mask = CustVector<uint8_t>();
+    }
+    return mask;
 }
 
-void create_table(const string& data_dir, const string& table_name, const CustVector<string>& columns, const string& primary_key) {
-    // Быстрая проверка файлов
-    const string base_path = data_dir + "/" + table_name;
-    if (fs::exists(base_path + ".json") ||
-        fs::exists(base_path + ".csv") ||
-        fs::exists(base_path + "_lock.txt") ||
-        fs::exists(base_path + "_pk_sequence.txt")) {
-        cout << "Error: Table files already exist for: " << table_name << endl;
+// Хеш-индекс по столбцу, если он есть у таблицы
+const HashIndex* find_hash_index(const Table* table, size_t column) {
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        if (!table->indexes[i]->sorted && table->indexes[i]->column == column) {
+            return &table->indexes[i]->hash;
+        }
+    }
+    return nullptr;
+}
+
+// Политика fsync для журнала вставок
+enum WalSyncPolicy {
+    WAL_SYNC_ALWAYS,  // fsync после каждой вставки
+    WAL_SYNC_INTERVAL,  // fsync после каждых wal_sync_interval вставок
+    WAL_SYNC_NEVER  // Сброс на диск остаётся на усмотрение ОС
+};
+
+// Запись JSON-файлов таблиц без отступов (--compact-json)
+bool json_compact_output = false;
+
+// Формат вывода результатов SELECT (--format)
+enum OutputFormat {
+    OUTPUT_TSV,  // Столбцы через табуляцию с заголовком и разделителем
+    OUTPUT_CSV,  // CSV с заголовком
+    OUTPUT_JSONL  // Один JSON-объект на строку результата
+};
+
+OutputFormat output_format = OUTPUT_TSV;
+
+// Этапы выполнения запроса, по которым собирается профиль
+enum ProfileStage { STAGE_PARSE, STAGE_LOCK_WAIT, STAGE_LOAD, STAGE_FILTER, STAGE_JOIN, STAGE_AGGREGATE, STAGE_OUTPUT, STAGE_SAVE, STAGE_COUNT };
+
+const char* const PROFILE_STAGE_NAMES[STAGE_COUNT] = {"parse_command", "lock wait", "load", "filter", "join", "aggregate", "output", "save"};
+
+// Профиль одного запроса (EXPLAIN ANALYZE или --profile)
+struct QueryProfile {
+    uint64_t nanos[STAGE_COUNT];  // Время этапа
+    size_t calls[STAGE_COUNT];  // Число входов в этап
+    size_t rows_in[STAGE_COUNT];  // Строк на входе этапа
+    size_t rows_out[STAGE_COUNT];  // Строк на выходе этапа
+    bool active[STAGE_COUNT];  // Этап уже замеряется (вложенные замеры не считаются дважды)
+
+    QueryProfile() {
+        memset(this, 0, sizeof(*this));
+    }
+};
+
+// Профиль выполняемого запроса (nullptr - профилирование выключено)
+QueryProfile* current_profile = nullptr;
+bool profile_queries = false;  // Профилировать каждый запрос (--profile)
+
+// Замер этапа на время жизни объекта
+class ProfileScope {
+public:
+    explicit ProfileScope(ProfileStage stage) : stage_(stage), counted_(false) {
+        if (current_profile && !current_profile->active[stage]) {
+            current_profile->active[stage] = true;
+            counted_ = true;
+            start_ = chrono::steady_clock::now();
+        }
+    }
+
+    ~ProfileScope() {
+        if (counted_) {
+            current_profile->nanos[stage_] += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_).count();
+            current_profile->calls[stage_]++;
+            current_profile->active[stage_] = false;
+        }
+    }
+
+private:
+    ProfileStage stage_;
+    bool counted_;
+    chrono::steady_clock::time_point start_;
+};
+
+// Учёт строк, прошедших через этап
+inline void profile_rows(ProfileStage stage, size_t rows_in, size_t rows_out) {
+    if (current_profile) {
+        current_profile->rows_in[stage] += rows_in;
+        current_profile->rows_out[stage] += rows_out;
+    }
+}
+
+WalSyncPolicy wal_sync_policy = WAL_SYNC_ALWAYS;
+size_t wal_sync_interval = 1;
+
+// Журнал сворачивается в основной файл, когда в нём не меньше строк, чем в основном файле
+// (но не раньше этого порога), поэтому суммарная стоимость сворачиваний линейна
+const size_t WAL_COMPACT_MIN_ROWS = 4096;
+
+// Целое число в канонической записи (без ведущих нулей, пробелов и знака "+"),
+// чтобы сравнение чисел совпадало со сравнением исходных строк
+bool parse_canonical_int(const string& text, int64_t& result) {
+    size_t digits_start = (!text.empty() && text[0] == '-') ? 1 : 0;
+    size_t digit_count = text.size() - digits_start;
+    if (digit_count == 0 || digit_count > 19) return false;
+    if (text[digits_start] == '0' && (digit_count > 1 || digits_start == 1)) return false;
+    for (size_t i = digits_start; i < text.size(); ++i) {
+        if (text[i] < '0' || text[i] > '9') return false;
+    }
+    errno = 0;
+    long long value = strtoll(text.c_str(), nullptr, 10);
+    if (errno == ERANGE) return false;
+    result = value;
+    return true;
+}
+
+// Число с плавающей точкой, занимающее всю строку
+bool parse_full_double(const string& text, double& result) {
+    if (text.empty() || isspace(static_cast<unsigned char>(text[0]))) return false;
+    const char* begin = text.c_str();
+    char* end = nullptr;
+    errno = 0;
+    result = strtod(begin, &end);
+    return end == begin + text.size() && errno != ERANGE;
+}
+
+// Тип столбца по имени из CREATE TABLE (пустая строка - тип не объявлен)
+bool column_type_from_name(const string& type_name, ColumnType& type) {
+    if (type_name == "INT") type = COLUMN_INT;
+    else if (type_name == "DOUBLE") type = COLUMN_DOUBLE;
+    else if (type_name == "STRING") type = COLUMN_STRING;
+    else return false;
+    return true;
+}
+
+// Добавление значения в типизированную колонку; false - значение не подходит по типу
+bool append_typed_value(TypedColumn& column, const string& value) {
+    if (column.type == COLUMN_INT) {
+        int64_t number;
+        if (!parse_canonical_int(value, number)) return false;
+        column.ints.push_back(number);
+    } else if (column.type == COLUMN_DOUBLE) {
+        double number;
+        if (!parse_full_double(value, number)) return false;
+        column.doubles.push_back(number);
+    } else {
+        column.codes.push_back(column.dictionary.intern(value));
+    }
+    return true;
+}
+
+// Построение колонки заданного типа; если значение не подходит, тип расширяется
+void build_typed_column(Table* table, size_t col, ColumnType type) {
+    static const string empty_value;
+    while (true) {
+        TypedColumn column;
+        column.type = type;
+        bool fits = true;
+        for (size_t i = 0; i < table->rows.size && fits; ++i) {
+            const CustVector<string>& row = table->rows[i];
+            fits = append_typed_value(column, col < row.size ? row[col] : empty_value);
+        }
+        if (fits) {
+            table->typed_columns[col] = std::move(column);
+            return;
+        }
+        type = static_cast<ColumnType>(type + 1);
+    }
+}
+
+// Индекс столбца первичного ключа (0, если столбец не найден)
+size_t primary_key_index(const Table* table) {
+    for (size_t i = 0; i < table->columns.size; ++i) {
+        if (table->columns[i] == table->primary_key) {
+            return i;
+        }
+    }
+    return 0;
+}
+
+// Во сколько раз диапазон ключей может превышать число строк, чтобы индекс
+// прямой адресации ещё имел смысл
+const size_t PK_INDEX_MAX_SPARSITY = 4;
+
+// Регистрация строки в индексе первичного ключа
+bool add_to_pk_index(Table* table, size_t row_index) {
+    const TypedColumn& column = table->typed_columns[primary_key_index(table)];
+    if (column.type != COLUMN_INT || column.ints[row_index] < 0) {
+        return false;
+    }
+    size_t key = static_cast<size_t>(column.ints[row_index]);
+    if (key > PK_INDEX_MAX_SPARSITY * (table->rows.size + 1) + 1024) {
+        return false;
+    }
+    while (table->pk_rows.size <= key) {
+        table->pk_rows.push_back(NO_ROW);
+    }
+    if (table->pk_rows[key] != NO_ROW) {
+        return false;  // Повторяющийся ключ
+    }
+    table->pk_rows[key] = row_index;
+    return true;
+}
+
+// Построение индекса первичного ключа. Ключи выдаются insert_data
+// последовательно, поэтому хватает массива с прямой адресацией
+void build_pk_index(Table* table) {
+    table->pk_rows = CustVector<size_t>();
+    table->pk_index_valid = primary_key_index(table) < table->typed_columns.size;
+    for (size_t i = 0; i < table->rows.size && table->pk_index_valid; ++i) {
+        table->pk_index_valid = add_to_pk_index(table, i);
+    }
+    if (!table->pk_index_valid) {
+        table->pk_rows = CustVector<size_t>();
+    }
+}
+
+// Построение колоночного представления всей таблицы. Для столбцов без
+// объявленного типа выбирается самый узкий тип, подходящий всем значениям
+void build_typed_columns(Table* table) {
+    table->typed_columns = CustVector<TypedColumn>();
+    table->typed_columns.reserve(table->columns.size);
+    for (size_t col = 0; col < table->columns.size; ++col) {
+        table->typed_columns.emplace_back();
+        if (!column_loaded(table, col)) {
+            // Неразобранный столбец запросом не используется; колонка остаётся пустой
+            table->typed_columns[col].type = COLUMN_STRING;
+            continue;
+        }
+        ColumnType type = COLUMN_INT;
+        if (col < table->column_types.size) {
+            column_type_from_name(table->column_types[col], type);
+        }
+        build_typed_column(table, col, type);
+    }
+    build_pk_index(table);
+}
+
+// Добавление в колонки последней вставленной строки таблицы
+void append_typed_row(Table* table) {
+    const CustVector<string>& row = table->rows[table->rows.size - 1];
+    for (size_t col = 0; col < table->typed_columns.size; ++col) {
+        TypedColumn& column = table->typed_columns[col];
+        if (!append_typed_value(column, col < row.size ? row[col] : string())) {
+            // Значение не подходит по выведенному типу - перестраиваем колонку с более общим типом
+            build_typed_column(table, col, static_cast<ColumnType>(column.type + 1));
+        }
+    }
+    if (table->pk_index_valid && !add_to_pk_index(table, table->rows.size - 1)) {
+        table->pk_index_valid = false;
+        table->pk_rows = CustVector<size_t>();
+    }
+}
+
+string trim(const string& str) {
+    size_t first = str.find_first_not_of(" \t\n\r\f\v");
+    if (string::npos == first) {
+        return ""; // Возвращаем пустую строку если только пробельные символы
+    }
+    size_t last = str.find_last_not_of(" \t\n\r\f\v");
+    return str.substr(first, last - first + 1);
+}
+
+// Есть ли на диске файл с данными таблицы
+bool table_exists_on_disk(const string& data_dir, const string& table_name) {
+    fs::path base = fs::path(data_dir) / table_name;
+    return fs::exists(base.string() + ".json") || fs::exists(base.string() + ".csv") ||
+           fs::exists(base.string() + ".bin");
+}
+
+// Режим блокировки таблицы: разделяемая для чтения, исключительная для записи
+enum TableLockMode {
+    SHARED_LOCK,  // SELECT: несколько читателей одновременно
+    EXCLUSIVE_LOCK  // INSERT, DELETE, SAVE, COMPACT
+};
+
+// Захват блокировки файла <table>_lock.txt через flock. Вызов блокируется
+// в ядре до освобождения конфликтующей блокировки, без опроса и sleep.
+// Возвращает дескриптор, который нужно передать в unlock_table (-1 при ошибке)
+int wait_for_unlock(const string& data_dir, const string& table_name, TableLockMode mode = EXCLUSIVE_LOCK) {
+    fs::path lock_file_path = fs::path(data_dir) / (table_name + "_lock.txt");
+    int lock_fd = open(lock_file_path.c_str(), O_RDWR | O_CLOEXEC);
+    if (lock_fd < 0 && errno == ENOENT) {
+        // Файл блокировки создаём только для существующей таблицы,
+        // чтобы запрос к несуществующей таблице не оставлял мусора
+        if (!table_exists_on_disk(data_dir, table_name)) {
+            return -1;
+        }
+        lock_fd = open(lock_file_path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    if (lock_fd < 0) {
+        cerr << "Failed to open lock file: " << lock_file_path << endl;
+        return -1;
+    }
+
+    int operation = mode == SHARED_LOCK ? LOCK_SH : LOCK_EX;
+    ProfileScope profile(STAGE_LOCK_WAIT);
+    while (flock(lock_fd, operation) != 0) {
+        if (errno != EINTR) {
+            cerr << "Failed to lock file: " << lock_file_path << endl;
+            close(lock_fd);
+            return -1;
+        }
+    }
+    return lock_fd;
+}
+
+// Снятие блокировки: закрытие дескриптора освобождает flock
+void unlock_table(int lock_fd) {
+    if (lock_fd >= 0) {
+        flock(lock_fd, LOCK_UN);
+        close(lock_fd);
+    }
+}
+
+size_t read_pk_sequence(const string& data_dir, const string& table_name) {
+    fs::path pk_file_path = fs::path(data_dir) / (table_name + "_pk_sequence.txt");
+    ifstream pk_file(pk_file_path);
+    if (!pk_file.is_open()) {
+        cerr << "Failed to open pk_sequence file for reading: " << pk_file_path << endl;
+        return 0;
+    }
+    size_t pk_sequence;
+    pk_file >> pk_sequence;
+    pk_file.close();
+    return pk_sequence;
+}
+
+// Временный файл, в который пишется новая версия file_path перед заменой
+fs::path temp_file_path(const fs::path& file_path) {
+    fs::path temp_path = file_path;
+    temp_path += ".tmp";
+    return temp_path;
+}
+
+// Замена файла новой версией, записанной в temp_path. Временный файл сбрасывается
+// на диск и атомарно переименовывается поверх старого, затем сбрасывается каталог.
+// При сбое на диске остаётся либо старая, либо новая версия целиком. С --fsync never
+// fsync пропускаются, но замена остаётся атомарной
+bool replace_file_durably(const fs::path& temp_path, const fs::path& file_path) {
+    if (wal_sync_policy != WAL_SYNC_NEVER) {
+        int fd = open(temp_path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0 || fsync(fd) != 0) {
+            if (fd >= 0) close(fd);
+            cerr << "Failed to sync file: " << temp_path << endl;
+            fs::remove(temp_path);
+            return false;
+        }
+        close(fd);
+    }
+    if (rename(temp_path.c_str(), file_path.c_str()) != 0) {
+        cerr << "Failed to replace file: " << file_path << endl;
+        fs::remove(temp_path);
+        return false;
+    }
+    if (wal_sync_policy != WAL_SYNC_NEVER) {
+        int dir_fd = open(file_path.parent_path().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dir_fd >= 0) {
+            fsync(dir_fd);
+            close(dir_fd);
+        }
+    }
+    return true;
+}
+
+bool write_pk_sequence(const string& data_dir, const string& table_name, size_t pk_sequence) {
+    fs::path pk_file_path = fs::path(data_dir) / (table_name + "_pk_sequence.txt");
+    fs::path temp_path = temp_file_path(pk_file_path);
+    ofstream pk_file(temp_path);
+    if (!pk_file.is_open()) {
+        cerr << "Failed to open pk_sequence file for writing: " << pk_file_path << endl;
+        return false;
+    }
+    pk_file << pk_sequence;
+    pk_file.close();
+    return pk_file && replace_file_durably(temp_path, pk_file_path);
+}
+
+// Файл, отображённый в память только для чтения
+struct MappedFile {
+    const char* data;  // Начало отображения
+    size_t size;  // Размер файла
+
+    MappedFile() : data(nullptr), size(0) {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+        if (data && size > 0) {
+            munmap(const_cast<char*>(data), size);
+        }
+    }
+
+    bool open(const fs::path& path) {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat info;
+        if (fstat(fd, &info) != 0) {
+            close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size > 0) {
+            void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapping == MAP_FAILED) {
+                close(fd);
+                size = 0;
+                return false;
+            }
+            madvise(mapping, size, MADV_SEQUENTIAL);
+            data = static_cast<const char*>(mapping);
+        }
+        close(fd);
+        return true;
+    }
+};
+
+// Дописывание строки в JSON с экранированием (как в nlohmann::json::dump)
+void append_json_string(string& out, const string& value) {
+    out += '"';
+    size_t start = 0;
+    for (size_t i = 0; i < value.size(); ++i) {
+        unsigned char c = static_cast<unsigned char>(value[i]);
+        if (c >= 0x20 && c != '"' && c != '\\') {
+            continue;
+        }
+        out.append(value, start, i - start);
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default: {
+                char escaped[8];
+                snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+                out += escaped;
+            }
+        }
+        start = i + 1;
+    }
+    out.append(value, start, string::npos);
+    out += '"';
+}
+
+// Потоковый разбор JSON без построения дерева. Поддерживает ровно то, что
+// нужно для файлов таблиц и журнала: объекты, массивы строк и пропуск
+// неизвестных значений
+struct JsonReader {
+    const char* pos;  // Текущая позиция
+    const char* end;  // Конец данных
+
+    JsonReader(const char* begin, const char* finish) : pos(begin), end(finish) {}
+
+    void skip_whitespace() {
+        while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t')) {
+            ++pos;
+        }
+    }
+
+    // Пропуск символа c, если он следующий после пробелов
+    bool consume(char c) {
+        skip_whitespace();
+        if (pos < end && *pos == c) {
+            ++pos;
+            return true;
+        }
+        return false;
+    }
+
+    void expect(char c) {
+        if (!consume(c)) {
+            fail(string("expected '") + c + "'");
+        }
+    }
+
+    [[noreturn]] void fail(const string& message) const {
+        throw runtime_error("JSON parse error: " + message);
+    }
+
+    void parse_string(string& out) {
+        expect('"');
+        while (true) {
+            // Копируем участок до ближайшей кавычки или обратной косой черты целиком
+            const char* start = pos;
+            while (pos < end && *pos != '"' && *pos != '\\') {
+                ++pos;
+            }
+            out.append(start, pos - start);
+            if (pos >= end) {
+                fail("unterminated string");
+            }
+            if (*pos++ == '"') {
+                return;
+            }
+            if (pos >= end) {
+                fail("unterminated escape");
+            }
+            char escaped = *pos++;
+            switch (escaped) {
+                case '"': out += '"'; break;
+                case '\\': out += '\\'; break;
+                case '/': out += '/'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'n': out += '\n'; break;
+                case 'r': out += '\r'; break;
+                case 't': out += '\t'; break;
+                case 'u': append_utf8(out, parse_code_point()); break;
+                default: fail("invalid escape");
+            }
+        }
+    }
+
+    // Строка или число/литерал (сохраняется его текст)
+    void parse_scalar(string& out) {
+        skip_whitespace();
+        if (pos < end && *pos == '"') {
+            parse_string(out);
+            return;
+        }
+        const char* start = pos;
+        while (pos < end && *pos != ',' && *pos != ']' && *pos != '}' &&
+               *pos != ' ' && *pos != '\n' && *pos != '\r' && *pos != '\t') {
+            ++pos;
+        }
+        if (pos == start) {
+            fail("expected value");
+        }
+        out.append(start, pos - start);
+    }
+
+    // Массив скалярных значений
+    void parse_string_array(CustVector<string>& out) {
+        expect('[');
+        if (consume(']')) {
+            return;
+        }
+        do {
+            parse_scalar(out.emplace_back());
+        } while (consume(','));
+        expect(']');
+    }
+
+    // Массив скалярных значений, из которого разбираются только отмеченные в mask
+    // элементы; на месте остальных остаются пустые строки (пусто mask - все)
+    void parse_string_array_projected(CustVector<string>& out, const CustVector<uint8_t>& mask) {
+        expect('[');
+        if (consume(']')) {
+            return;
+        }
+        do {
+            if (out.size < mask.size && !mask[out.size]) {
+                out.emplace_back();
+                skip_scalar();
+            } else {
+                parse_scalar(out.emplace_back());
+            }
+        } while (consume(','));
+        expect(']');
+    }
+
+    // Пропуск строки или числа/литерала без копирования текста
+    void skip_scalar() {
+        skip_whitespace();
+        if (pos < end && *pos == '"') {
+            ++pos;
+            while (pos < end && *pos != '"') {
+                pos += *pos == '\\' ? 2 : 1;
+            }
+            if (pos >= end) {
+                fail("unterminated string");
+            }
+            ++pos;
+            return;
+        }
+        const char* start = pos;
+        while (pos < end && *pos != ',' && *pos != ']' && *pos != '}' &&
+               *pos != ' ' && *pos != '\n' && *pos != '\r' && *pos != '\t') {
+            ++pos;
+        }
+        if (pos == start) {
+            fail("expected value");
+        }
+    }
+
+    // Пропуск значения любого вида
+    void skip_value() {
+        skip_whitespace();
+        if (pos >= end) {
+            fail("unexpected end of input");
+        }
+        if (*pos == '{' || *pos == '[') {
+            char close = *pos == '{' ? '}' : ']';
+            ++pos;
+            if (consume(close)) {
+                return;
+            }
+            do {
+                if (close == '}') {
+                    string key;
+                    parse_string(key);
+                    expect(':');
+                }
+                skip_value();
+            } while (consume(','));
+            expect(close);
+            return;
+        }
+        string ignored;
+        parse_scalar(ignored);
+    }
+
+private:
+    unsigned parse_hex4() {
+        if (end - pos < 4) {
+            fail("invalid unicode escape");
+        }
+        unsigned value = 0;
+        for (int i = 0; i < 4; ++i) {
+            char c = *pos++;
+            value <<= 4;
+            if (c >= '0' && c <= '9') value |= c - '0';
+            else if (c >= 'a' && c <= 'f') value |= c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') value |= c - 'A' + 10;
+            else fail("invalid unicode escape");
+        }
+        return value;
+    }
+
+    unsigned parse_code_point() {
+        unsigned code = parse_hex4();
+        // Суррогатная пара UTF-16
+        if (code >= 0xD800 && code <= 0xDBFF && end - pos >= 6 && pos[0] == '\\' && pos[1] == 'u') {
+            pos += 2;
+            unsigned low = parse_hex4();
+            if (low >= 0xDC00 && low <= 0xDFFF) {
+                return 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+            }
+            fail("invalid surrogate pair");
+        }
+        return code;
+    }
+
+    static void append_utf8(string& out, unsigned code) {
+        if (code < 0x80) {
+            out += static_cast<char>(code);
+        } else if (code < 0x800) {
+            out += static_cast<char>(0xC0 | (code >> 6));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else if (code < 0x10000) {
+            out += static_cast<char>(0xE0 | (code >> 12));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        } else {
+            out += static_cast<char>(0xF0 | (code >> 18));
+            out += static_cast<char>(0x80 | ((code >> 12) & 0x3F));
+            out += static_cast<char>(0x80 | ((code >> 6) & 0x3F));
+            out += static_cast<char>(0x80 | (code & 0x3F));
+        }
+    }
+};
+
+// Запись JSON-массива строк. В красивом формате каждый элемент на своей
+// строке с отступом indent + 4 (как у dump(4))
+void append_json_array(string& out, const CustVector<string>& values, size_t indent) {
+    if (values.size == 0) {
+        out += "[]";
+        return;
+    }
+    out += '[';
+    for (size_t i = 0; i < values.size; ++i) {
+        if (i > 0) out += ',';
+        if (!json_compact_output) {
+            out += '\n';
+            out.append(indent + 4, ' ');
+        }
+        append_json_string(out, values[i]);
+    }
+    if (!json_compact_output) {
+        out += '\n';
+        out.append(indent, ' ');
+    }
+    out += ']';
+}
+
+bool save_table_json(const string& data_dir, const Table& table) {
+    fs::path file_path = fs::path(data_dir) / (table.name + ".json");
+    fs::path temp_path = temp_file_path(file_path);
+    ofstream file(temp_path, ios::binary);
+    if (!file.is_open()) {
+        cout << "Failed to open file for writing: " << temp_path << endl;
+        return false;
+    }
+
+    // Таблица сериализуется потоком, без промежуточного дерева JSON.
+    // Ключи идут в алфавитном порядке, как и раньше при выводе через nlohmann
+    const size_t flush_threshold = 1 << 20;
+    const char* separator = json_compact_output ? "," : ",\n    ";
+    const char* colon = json_compact_output ? ":" : ": ";
+    string out = json_compact_output ? "{" : "{\n    ";
+    if (table.column_types.size > 0) {
+        out += string("\"column_types\"") + colon;
+        append_json_array(out, table.column_types, 4);
+        out += separator;
+    }
+    out += string("\"columns\"") + colon;
+    append_json_array(out, table.columns, 4);
+    out += separator;
+    out += string("\"name\"") + colon;
+    append_json_string(out, table.name);
+    out += separator;
+    out += string("\"primary_key\"") + colon;
+    append_json_string(out, table.primary_key);
+    out += separator;
+    out += string("\"rows\"") + colon;
+    if (table.rows.size == 0) {
+        out += "[]";
+    } else {
+        out += '[';
+        for (size_t i = 0; i < table.rows.size; ++i) {
+            if (i > 0) out += ',';
+            if (!json_compact_output) out += "\n        ";
+            append_json_array(out, table.rows[i], 8);
+            if (out.size() >= flush_threshold) {
+                file.write(out.data(), out.size());
+                out.clear();
+            }
+        }
+        out += json_compact_output ? "]" : "\n    ]";
+    }
+    out += json_compact_output ? "}" : "\n}";
+    file.write(out.data(), out.size());
+    file.close();
+    if (!file) {
+        cout << "Failed to write file: " << temp_path << endl;
+        fs::remove(temp_path);
+        return false;
+    }
+    return replace_file_durably(temp_path, file_path);
+}
+
+void load_table_json(const string& data_dir, const string& table_name, const CustVector<string>* needed) {
+    fs::path file_path = fs::path(data_dir) / (table_name + ".json");
+    MappedFile file;
+    if (!file.open(file_path)) {
+        cout << "File not found: " << file_path << endl;
+        return;
+    }
+
+    // Разбираем файл потоком прямо в структуру таблицы, без дерева JSON
+    Table* table_ptr = new Table(table_name);
+    try {
+        JsonReader reader(file.data, file.data + file.size);
+        reader.expect('{');
+        if (!reader.consume('}')) {
+            do {
+                string key;
+                reader.parse_string(key);
+                reader.expect(':');
+                if (key == "columns") {
+                    reader.parse_string_array(table_ptr->columns);
+                } else if (key == "rows") {
+                    // Столбцы и первичный ключ записываются до строк, поэтому маска уже известна
+                    table_ptr->loaded_columns = projection_mask(data_dir, table_ptr, needed);
+                    reader.expect('[');
+                    if (!reader.consume(']')) {
+                        do {
+                            reader.parse_string_array_projected(append_row(table_ptr), table_ptr->loaded_columns);
+                        } while (reader.consume(','));
+                        reader.expect(']');
+                    }
+                } else if (key == "primary_key") {
+                    reader.parse_scalar(table_ptr->primary_key);
+                } else if (key == "column_types") {
+                    reader.parse_string_array(table_ptr->column_types);
+                } else {
+                    reader.skip_value();
+                }
+            } while (reader.consume(','));
+            reader.expect('}');
+        }
+    } catch (...) {
+        delete table_ptr;
+        throw;
+    }
+    table_ptr->file_format = "json"; // Устанавливаем формат файла
+
+    tables.put(table_name, table_ptr);
+}
+
+// Поиск ближайшего разделителя поля или строки CSV (',', '\n', '\r').
+// На x86 проверяется по 16 байт за инструкцию
+inline const char* find_csv_delimiter(const char* pos, const char* end) {
+#ifdef __SSE2__
+    const __m128i comma = _mm_set1_epi8(',');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriage = _mm_set1_epi8('\r');
+    while (end - pos >= 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(pos));
+        __m128i hits = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, comma), _mm_cmpeq_epi8(chunk, newline)),
+                                    _mm_cmpeq_epi8(chunk, carriage));
+        int mask = _mm_movemask_epi8(hits);
+        if (mask != 0) {
+            return pos + __builtin_ctz(mask);
+        }
+        pos += 16;
+    }
+#endif
+    while (pos < end && *pos != ',' && *pos != '\n' && *pos != '\r') {
+        ++pos;
+    }
+    return pos;
+}
+
+// Разбор CSV по RFC 4180: поля в кавычках могут содержать запятые, переводы
+// строк и удвоенные кавычки. Одиночная кавычка внутри поля считается обычным
+// символом (так записывал поля старый формат сохранения)
+struct CsvReader {
+    const char* pos;  // Текущая позиция
+    const char* end;  // Конец данных
+
+    CsvReader(const char* begin, const char* finish) : pos(begin), end(finish) {
+        skip_empty_lines();
+    }
+
+    bool at_end() const {
+        return pos >= end;
+    }
+
+    // Чтение одной записи в record
+    void read_record(CustVector<string>& record) {
+        while (true) {
+            if (pos < end && *pos == '"') {
+                read_quoted(record.emplace_back());
+            } else {
+                const char* stop = find_csv_delimiter(pos, end);
+                record.emplace_back(pos, stop - pos);
+                pos = stop;
+            }
+
+            if (pos < end && *pos == ',') {
+                ++pos;
+                continue;
+            }
+            skip_empty_lines();
+            return;
+        }
+    }
+
+    // Чтение записи, в которой текст берётся только у полей, отмеченных в mask;
+    // остальные поля пропускаются без копирования и остаются пустыми
+    void read_record_projected(CustVector<string>& record, const CustVector<uint8_t>& mask) {
+        while (true) {
+            bool keep = record.size >= mask.size || mask[record.size];
+            if (pos < end && *pos == '"') {
+                if (keep) {
+                    read_quoted(record.emplace_back());
+                } else {
+                    record.emplace_back();
+                    skip_quoted();
+                }
+            } else {
+                const char* stop = find_csv_delimiter(pos, end);
+                if (keep) {
+                    record.emplace_back(pos, stop - pos);
+                } else {
+                    record.emplace_back();
+                }
+                pos = stop;
+            }
+
+            if (pos < end && *pos == ',') {
+                ++pos;
+                continue;
+            }
+            skip_empty_lines();
+            return;
+        }
+    }
+
+private:
+    // Пропуск поля в кавычках по тем же правилам, что и read_quoted
+    void skip_quoted() {
+        ++pos;  // Открывающая кавычка
+        while (pos < end) {
+            const char* quote = static_cast<const char*>(memchr(pos, '"', end - pos));
+            if (!quote) {
+                pos = end;
+                return;
+            }
+            pos = quote + 1;
+            if (pos < end && *pos == '"') {
+                ++pos;
+            } else if (pos >= end || *pos == ',' || *pos == '\n' || *pos == '\r') {
+                return;  // Закрывающая кавычка
+            }
+        }
+    }
+
+    void read_quoted(string& field) {
+        ++pos;  // Открывающая кавычка
+        while (pos < end) {
+            const char* quote = static_cast<const char*>(memchr(pos, '"', end - pos));
+            if (!quote) {
+                field.append(pos, end - pos);
+                pos = end;
+                return;
+            }
+            field.append(pos, quote - pos);
+            pos = quote + 1;
+            if (pos < end && *pos == '"') {
+                field += '"';
+                ++pos;
+            } else if (pos >= end || *pos == ',' || *pos == '\n' || *pos == '\r') {
+                return;  // Закрывающая кавычка
+            } else {
+                field += '"';
+            }
+        }
+    }
+
+    void skip_empty_lines() {
+        while (pos < end && (*pos == '\n' || *pos == '\r')) {
+            ++pos;
+        }
+    }
+};
+
+// Запись поля CSV в кавычках; кавычки внутри значения удваиваются
+void write_csv_field(ostream& out, const string& value) {
+    out << '"';
+    if (value.find('"') == string::npos) {
+        out << value;
+    } else {
+        for (size_t i = 0; i < value.size(); ++i) {
+            if (value[i] == '"') out << '"';
+            out << value[i];
+        }
+    }
+    out << '"';
+}
+
+// Поле CSV для вывода результатов: в кавычки берётся только при необходимости
+void append_csv_field(string& out, const string& value) {
+    if (value.find_first_of(",\"\r\n") == string::npos) {
+        out += value;
+        return;
+    }
+    out += '"';
+    for (size_t i = 0; i < value.size(); ++i) {
+        if (value[i] == '"') out += '"';
+        out += value[i];
+    }
+    out += '"';
+}
+
+// Загрузка таблицы из CSV с указанием директории.
+// Файл отображается в память и разбирается на месте, без построчного копирования
+void load_table_csv(const string& data_dir, const string& table_name, const CustVector<string>* needed) {
+    fs::path file_path = fs::path(data_dir) / (table_name + ".csv");
+    MappedFile file;
+    if (!file.open(file_path)) {
+        cout << "File not found: " << file_path << endl;
+        return;
+    }
+
+    Table* table_ptr = new Table(table_name);
+    CsvReader reader(file.data, file.data + file.size);
+    bool has_primary_key_info = false;
+    string primary_key_from_csv;
+
+    // Первая запись - заголовок со столбцами
+    if (!reader.at_end()) {
+        CustVector<string> row;
+        reader.read_record(row);
+
+        // Объявленные типы столбцов хранятся в последней ячейке заголовка
+        if (row.size > 0 && row[row.size - 1].find("TYPES:") == 0) {
+            istringstream types_stream(row[row.size - 1].substr(6));
+            string type;
+            while (getline(types_stream, type, ';')) {
+                table_ptr->column_types.push_back(type);
+            }
+            CustVector<string> without_types;
+            for (size_t i = 0; i < row.size - 1; ++i) {
+                without_types.push_back(row[i]);
+            }
+            row = std::move(without_types);
+        }
+        // Проверяем, есть ли информация о первичном ключе в последнем элементе
+        if (row.size > 0) {
+            string last_column = row[row.size - 1];
+            if (last_column.find("PRIMARY_KEY:") == 0) {
+                // Извлекаем первичный ключ
+                primary_key_from_csv = last_column.substr(12);
+                has_primary_key_info = true;
+                // Удаляем информацию о PK из столбцов
+                CustVector<string> cleaned_columns;
+                for (size_t i = 0; i < row.size - 1; ++i) {
+                    cleaned_columns.push_back(row[i]);
+                }
+                table_ptr->columns = std::move(cleaned_columns);
+            } else {
+                table_ptr->columns = std::move(row);
+            }
+        }
+    }
+
+    // Устанавливаем первичный ключ
+    if (has_primary_key_info) {
+        table_ptr->primary_key = primary_key_from_csv;
+    } else {
+        // По умолчанию первым столбцом является ID
+        table_ptr->primary_key = "ID";
+    }
+
+    // Строки заполняем прямо в таблице, чтобы не копировать их
+    table_ptr->loaded_columns = projection_mask(data_dir, table_ptr, needed);
+    if (table_ptr->loaded_columns.size == 0) {
+        while (!reader.at_end()) {
+            reader.read_record(append_row(table_ptr));
+        }
+    } else {
+        while (!reader.at_end()) {
+            reader.read_record_projected(append_row(table_ptr), table_ptr->loaded_columns);
+        }
+    }
+
+    // Проверяем и корректируем индексы (должны начинаться с 1)
+    for (size_t i = 0; i < table_ptr->rows.size; ++i) {
+        if (table_ptr->rows[i].size > 0) {
+            try {
+                int current_id = stoi(table_ptr->rows[i][0]);
+                if (current_id == 0) {
+                    // Если ID = 0, меняем на i+1
+                    table_ptr->rows[i][0] = to_string(i + 1);
+                }
+            } catch (...) {
+                // Если не число, устанавливаем правильный ID
+                table_ptr->rows[i][0] = to_string(i + 1);
+            }
+        }
+    }
+
+    table_ptr->file_format = "csv"; // Устанавливаем формат файла
+    tables.put(table_name, table_ptr);
+}
+
+// Бинарный формат таблицы (.bin). Файл разбит на страницы по BINARY_PAGE_SIZE байт:
+//   страница 0 - заголовок BinaryHeader, за ним схема (строки с длиной uint32)
+//               и каталог столбцов (по BinaryColumnEntry на столбец);
+//   далее для каждого столбца с границы страницы - массив смещений uint64[rows + 1]
+//   и с следующей границы страницы - байты значений подряд.
+// Значение ячейки row столбца - байты [offsets[row], offsets[row + 1]) его области данных,
+// поэтому при открытии ячейки вырезаются по смещениям, без разбора и раскавычивания текста.
+// Формат компактный, но не ленивый: ячейки копируются в строки таблицы, и открытие
+// остаётся линейным по объёму данных, как у JSON и CSV.
+// Короткие строки таблицы дополняются пустыми значениями до числа столбцов
+const char BINARY_MAGIC[8] = {'T', 'B', 'L', 'B', 'I', 'N', '0', '1'};
+const size_t BINARY_PAGE_SIZE = 4096;
+
+struct BinaryHeader {
+    char magic[8];  // BINARY_MAGIC
+    uint64_t column_count;  // Число столбцов
+    uint64_t row_count;  // Число строк
+    uint64_t schema_size;  // Размер схемы сразу после заголовка
+};
+
+struct BinaryColumnEntry {
+    uint64_t offsets_pos;  // Позиция массива смещений
+    uint64_t data_pos;  // Позиция байтов значений
+    uint64_t data_size;  // Размер байтов значений
+};
+
+inline uint64_t align_to_page(uint64_t pos) {
+    return (pos + BINARY_PAGE_SIZE - 1) / BINARY_PAGE_SIZE * BINARY_PAGE_SIZE;
+}
+
+void append_binary_string(string& out, const string& value) {
+    uint32_t length = static_cast<uint32_t>(value.size());
+    out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+    out += value;
+}
+
+void append_binary_strings(string& out, const CustVector<string>& values) {
+    uint32_t count = static_cast<uint32_t>(values.size);
+    out.append(reinterpret_cast<const char*>(&count), sizeof(count));
+    for (size_t i = 0; i < values.size; ++i) {
+        append_binary_string(out, values[i]);
+    }
+}
+
+// Чтение схемы бинарного файла с проверкой границ
+struct BinaryReader {
+    const char* pos;
+    const char* end;
+
+    BinaryReader(const char* begin, const char* finish) : pos(begin), end(finish) {}
+
+    uint32_t read_u32() {
+        if (end - pos < static_cast<ptrdiff_t>(sizeof(uint32_t))) {
+            throw runtime_error("Corrupted binary table file: schema is truncated");
+        }
+        uint32_t value;
+        memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return value;
+    }
+
+    void read_string(string& out) {
+        uint32_t length = read_u32();
+        if (static_cast<size_t>(end - pos) < length) {
+            throw runtime_error("Corrupted binary table file: schema is truncated");
+        }
+        out.assign(pos, length);
+        pos += length;
+    }
+
+    void read_strings(CustVector<string>& out) {
+        uint32_t count = read_u32();
+        for (uint32_t i = 0; i < count; ++i) {
+            read_string(out.emplace_back());
+        }
+    }
+};
+
+bool save_table_binary(const string& data_dir, const Table& table) {
+    fs::path file_path = fs::path(data_dir) / (table.name + ".bin");
+    fs::path temp_path = temp_file_path(file_path);
+    ofstream file(temp_path, ios::binary);
+    if (!file.is_open()) {
+        cout << "Failed to open file for writing: " << temp_path << endl;
+        return false;
+    }
+
+    size_t column_count = table.columns.size;
+    size_t row_count = table.rows.size;
+    string schema;
+    append_binary_string(schema, table.name);
+    append_binary_string(schema, table.primary_key);
+    append_binary_strings(schema, table.columns);
+    append_binary_strings(schema, table.column_types);
+
+    // Раскладка столбцов вычисляется заранее, чтобы писать файл одним проходом
+    CustVector<BinaryColumnEntry> directory;
+    directory.reserve(column_count);
+    uint64_t pos = align_to_page(sizeof(BinaryHeader) + schema.size() + column_count * sizeof(BinaryColumnEntry));
+    for (size_t col = 0; col < column_count; ++col) {
+        BinaryColumnEntry entry;
+        entry.offsets_pos = pos;
+        entry.data_pos = align_to_page(pos + (row_count + 1) * sizeof(uint64_t));
+        entry.data_size = 0;
+        for (size_t i = 0; i < row_count; ++i) {
+            if (col < table.rows[i].size) entry.data_size += table.rows[i][col].size();
+        }
+        directory.push_back(entry);
+        pos = align_to_page(entry.data_pos + entry.data_size);
+    }
+
+    BinaryHeader header;
+    memcpy(header.magic, BINARY_MAGIC, sizeof(header.magic));
+    header.column_count = column_count;
+    header.row_count = row_count;
+    header.schema_size = schema.size();
+
+    const size_t flush_threshold = 1 << 20;
+    string out(reinterpret_cast<const char*>(&header), sizeof(header));
+    out += schema;
+    out.append(reinterpret_cast<const char*>(directory.data), column_count * sizeof(BinaryColumnEntry));
+    uint64_t written = 0;
+    auto pad_to = [&](uint64_t target) {
+        out.append(target - written - out.size(), '\0');
+    };
+    auto flush_if_full = [&]() {
+        if (out.size() >= flush_threshold) {
+            file.write(out.data(), out.size());
+            written += out.size();
+            out.clear();
+        }
+    };
+
+    for (size_t col = 0; col < column_count; ++col) {
+        pad_to(directory[col].offsets_pos);
+        uint64_t offset = 0;
+        out.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+        for (size_t i = 0; i < row_count; ++i) {
+            if (col < table.rows[i].size) offset += table.rows[i][col].size();
+            out.append(reinterpret_cast<const char*>(&offset), sizeof(offset));
+            flush_if_full();
+        }
+        pad_to(directory[col].data_pos);
+        for (size_t i = 0; i < row_count; ++i) {
+            if (col < table.rows[i].size) out += table.rows[i][col];
+            flush_if_full();
+        }
+    }
+    pad_to(pos);
+    file.write(out.data(), out.size());
+    file.close();
+    if (!file) {
+        cout << "Failed to write file: " << temp_path << endl;
+        fs::remove(temp_path);
+        return false;
+    }
+    if (!replace_file_durably(temp_path, file_path)) {
+        return false;
+    }
+    cout << "Table saved to " << file_path << endl;
+    return true;
+}
+
+// Открытие бинарной таблицы: значения копируются в строки по готовым смещениям
+// без разбора текста. Отображение файла лишь избавляет от промежуточного буфера
+void load_table_binary(const string& data_dir, const string& table_name, const CustVector<string>* needed) {
+    fs::path file_path = fs::path(data_dir) / (table_name + ".bin");
+    MappedFile file;
+    if (!file.open(file_path)) {
+        cout << "File not found: " << file_path << endl;
+        return;
+    }
+
+    BinaryHeader header;
+    if (file.size < sizeof(header)) {
+        throw runtime_error("Corrupted binary table file: " + file_path.string());
+    }
+    memcpy(&header, file.data, sizeof(header));
+    // Каждая строка занимает смещение в массиве каждого столбца, поэтому строк не больше,
+    // чем слов в файле. Без столбцов строкам негде лежать (у таблицы всегда есть первичный ключ),
+    // и число строк проверяется здесь, до резервирования памяти под них
+    if (memcmp(header.magic, BINARY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.schema_size > file.size - sizeof(header) ||
+        header.column_count > (file.size - sizeof(header) - header.schema_size) / sizeof(BinaryColumnEntry) ||
+        header.row_count >= file.size / sizeof(uint64_t) ||
+        (header.column_count == 0 && header.row_count != 0)) {
+        throw runtime_error("Corrupted binary table file: " + file_path.string());
+    }
+
+    Table* table_ptr = new Table(table_name);
+    try {
+        const char* schema = file.data + sizeof(header);
+        BinaryReader reader(schema, schema + header.schema_size);
+        string stored_name;
+        reader.read_string(stored_name);
+        reader.read_string(table_ptr->primary_key);
+        reader.read_strings(table_ptr->columns);
+        reader.read_strings(table_ptr->column_types);
+        if (table_ptr->columns.size != header.column_count) {
+            throw runtime_error("Corrupted binary table file: " + file_path.string());
+        }
+
+        // Проверяем, что области всех столбцов лежат внутри файла
+        size_t column_count = header.column_count;
+        size_t row_count = header.row_count;
+        CustVector<const uint64_t*> offsets;
+        CustVector<const char*> values;
+        const char* directory = schema + header.schema_size;
+        for (size_t col = 0; col < column_count; ++col) {
+            BinaryColumnEntry entry;
+            memcpy(&entry, directory + col * sizeof(entry), sizeof(entry));
+            if (entry.offsets_pos % sizeof(uint64_t) != 0 || entry.offsets_pos > file.size ||
+                row_count >= (file.size - entry.offsets_pos) / sizeof(uint64_t) ||
+                entry.data_pos > file.size || entry.data_size > file.size - entry.data_pos) {
+                throw runtime_error("Corrupted binary table file: " + file_path.string());
+            }
+            const uint64_t* column_offsets = reinterpret_cast<const uint64_t*>(file.data + entry.offsets_pos);
+            if (column_offsets[row_count] > entry.data_size) {
+                throw runtime_error("Corrupted binary table file: " + file_path.string());
+            }
+            offsets.push_back(column_offsets);
+            values.push_back(file.data + entry.data_pos);
+        }
+
+        table_ptr->loaded_columns = projection_mask(data_dir, table_ptr, needed);
+        table_ptr->rows.reserve(row_count);
+        for (size_t i = 0; i < row_count; ++i) {
+            CustVector<string>& row = append_row(table_ptr);
+            for (size_t col = 0; col < column_count; ++col) {
+                if (!column_loaded(table_ptr, col)) {
+                    row.emplace_back();
+                    continue;
+                }
+                uint64_t begin = offsets[col][i];
+                uint64_t end = offsets[col][i + 1];
+                if (begin > end || end > offsets[col][row_count]) {
+                    throw runtime_error("Corrupted binary table file: " + file_path.string());
+                }
+                row.emplace_back(values[col] + begin, end - begin);
+            }
+        }
+    } catch (...) {
+        delete table_ptr;
+        throw;
+    }
+    table_ptr->file_format = "bin"; // Устанавливаем формат файла
+
+    tables.put(table_name, table_ptr);
+}
+
+fs::path wal_path(const string& data_dir, const string& table_name) {
+    return fs::path(data_dir) / (table_name + "_wal.txt");
+}
+
+// Воспроизведение журнала вставок поверх загруженного основного файла.
+// Каждая строка журнала - JSON-массив значений одной строки таблицы.
+// Ключи строкам журнала выдаются по возрастанию после всех строк основного файла,
+// поэтому строка с ключом не больше ключа последней строки основного файла уже
+// свёрнута в него (сбой между заменой файла и удалением журнала) и пропускается.
+// Последовательность ключей учитывает и пропущенные строки. Недописанный хвост
+// только пропускается: читатель держит разделяемую блокировку, а отрезает хвост
+// следующий писатель под исключительной (append_to_wal)
+void replay_wal(const string& data_dir, Table* table) {
+    table->wal_rows = 0;
+    table->wal_torn_at = SIZE_MAX;
+    fs::path path = wal_path(data_dir, table->name);
+    MappedFile file;
+    if (!file.open(path)) {
+        return;
+    }
+
+    size_t pk_index = primary_key_index(table);
+    int64_t folded_key = 0;
+    bool check_folded = table->rows.size > 0 && pk_index < table->rows[table->rows.size - 1].size &&
+                        parse_canonical_int(table->rows[table->rows.size - 1][pk_index], folded_key);
+
+    const char* pos = file.data;
+    const char* end = file.data + file.size;
+    bool torn = false;
+    while (pos < end) {
+        const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if (!newline) {
+            // Последняя строка без перевода строки - запись прервалась
+            torn = true;
+            break;
+        }
+        try {
+            JsonReader reader(pos, newline);
+            reader.parse_string_array(append_row(table));
+        } catch (const runtime_error&) {
+            table->rows.pop_back();
+            torn = true;
+            break;
+        }
+        const CustVector<string>& row = table->rows[table->rows.size - 1];
+        int64_t key;
+        if (check_folded && pk_index < row.size && parse_canonical_int(row[pk_index], key) && key <= folded_key) {
+            table->rows.pop_back();
+        }
+        table->wal_rows++;
+        pos = newline + 1;
+    }
+
+    if (torn) {
+        table->wal_torn_at = pos - file.data;
+    }
+    table->pk_sequence += table->wal_rows;
+}
+
+fs::path deleted_log_path(const string& data_dir, const string& table_name) {
+    return fs::path(data_dir) / (table_name + "_deleted.txt");
+}
+
+// Восстановление битовой карты удалённых строк. Журнал удалений хранит номера строк
+// (в порядке основного файла и журнала вставок) по одному на строку и очищается
+// при каждой полной перезаписи таблицы
+void replay_deleted_log(const string& data_dir, Table* table) {
+    table->deleted_bits = CustVector<uint64_t>();
+    table->deleted_rows = 0;
+    MappedFile file;
+    if (!file.open(deleted_log_path(data_dir, table->name))) {
+        return;
+    }
+
+    // В журнале - значения первичного ключа удалённых строк: в отличие от номеров строк
+    // они не сдвигаются при сворачивании, поэтому повторное воспроизведение журнала
+    // после сбоя безопасно. Ключи ищем по индексу первичного ключа, а без него - по хешу
+    size_t pk_index = primary_key_index(table);
+    HashIndex key_index;
+    if (!table->pk_index_valid) {
+        key_index.build(table, pk_index);
+    }
+    const char* pos = file.data;
+    const char* end = file.data + file.size;
+    string key;
+    while (pos < end) {
+        const char* newline = static_cast<const char*>(memchr(pos, '\n', end - pos));
+        if (!newline) {
+            break;  // Недописанная последняя строка
+        }
+        key.assign(pos, newline - pos);
+        int64_t value;
+        if (table->pk_index_valid) {
+            if (parse_canonical_int(key, value) && value >= 0 && static_cast<size_t>(value) < table->pk_rows.size &&
+                table->pk_rows[value] != NO_ROW) {
+                mark_row_deleted(table, table->pk_rows[value]);
+            }
+        } else {
+            for (size_t row = key_index.find(key); row != NO_ROW; row = key_index.next_match(row, key)) {
+                mark_row_deleted(table, row);
+            }
+        }
+        pos = newline + 1;
+    }
+}
+
+// Состояние файлов таблицы на диске: основной файл, журналы вставок и удалений
+FileStamp table_file_stamp(const string& data_dir, const string& table_name, const string& file_format) {
+    FileStamp stamp;
+    struct stat info;
+    fs::path main_path = fs::path(data_dir) / (table_name + "." + (file_format.empty() ? "json" : file_format));
+    if (stat(main_path.c_str(), &info) == 0) {
+        stamp.main_mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+        stamp.main_size = info.st_size;
+    }
+    if (stat(wal_path(data_dir, table_name).c_str(), &info) == 0) {
+        stamp.wal_size = info.st_size;
+    }
+    if (stat(deleted_log_path(data_dir, table_name).c_str(), &info) == 0) {
+        stamp.deleted_size = info.st_size;
+    }
+    return stamp;
+}
+
+FileStamp table_file_stamp(const string& data_dir, const Table& table) {
+    return table_file_stamp(data_dir, table.name, table.file_format);
+}
+
+// Запоминание состояния файлов после собственной записи, чтобы она не вызвала перечитывание
+void refresh_file_stamp(const string& data_dir, Table& table) {
+    table.cache.stamp = table_file_stamp(data_dir, table);
+}
+
+// Загрузка таблицы с диска. Если задан needed (имена столбцов, упомянутых запросом),
+// текст остальных столбцов не разбирается - таблица загружается частично
+void load_table(const string& data_dir, const string& table_name, const CustVector<string>* needed = nullptr) {
+    ProfileScope profile(STAGE_LOAD);
+    fs::path json_path = fs::path(data_dir) / (table_name + ".json");
+    fs::path csv_path = fs::path(data_dir) / (table_name + ".csv");
+    fs::path bin_path = fs::path(data_dir) / (table_name + ".bin");
+
+    bool json_exists = fs::exists(json_path);
+    bool csv_exists = fs::exists(csv_path);
+    bool bin_exists = fs::exists(bin_path);
+
+    if (json_exists + csv_exists + bin_exists > 1) {
+        cout << "Error: Several table files (JSON, CSV, BIN) exist for table '" << table_name << "'" << endl;
+        return;
+    }
+
+    // Штамп снимается до чтения: запись другого процесса, пришедшая во время загрузки,
+    // даст расхождение при следующей проверке, а не потеряется
+    FileStamp stamp = table_file_stamp(data_dir, table_name, json_exists ? "json" : csv_exists ? "csv" : "bin");
+    if (json_exists) {
+        load_table_json(data_dir, table_name, needed);
+    }
+    else if (csv_exists) {
+        load_table_csv(data_dir, table_name, needed);
+    }
+    else if (bin_exists) {
+        load_table_binary(data_dir, table_name, needed);
+    }
+    else {
+        cerr << "Error: No table file found for '" << table_name << "' in directory '" << data_dir << "'" << endl;
+        return;
+    }
+
+    // Последовательность ключей и строки, вставленные после последнего сворачивания журнала
+    Table* table = tables.get(table_name);
+    if (table) {
+        if (fs::exists(fs::path(data_dir) / (table_name + "_pk_sequence.txt"))) {
+            table->pk_sequence = read_pk_sequence(data_dir, table_name);
+        }
+        replay_wal(data_dir, table);
+        build_typed_columns(table);
+        replay_deleted_log(data_dir, table);
+        load_index_definitions(data_dir, table);
+        profile_rows(STAGE_LOAD, 0, table->rows.size);
+        table->cache.stamp = stamp;
+        table_cache.resize(table, estimate_table_bytes(table));
+    }
+}
+
+// Вытеснение давно не использованных таблиц, пока кэш не уложится в бюджет.
+// Записи журнала, ещё не сброшенные на диск, перед вытеснением сбрасываются
+void enforce_cache_budget() {
+    while (table_cache.over_budget()) {
+        Table* victim = table_cache.eviction_candidate();
+        if (!victim) {
+            return;
+        }
+        if (victim->wal_fd >= 0 && victim->wal_unsynced > 0) {
+            fsync(victim->wal_fd);
+        }
+        tables.erase(victim->name);
+    }
+}
+
+// Возвращает таблицу из памяти, загружая её с диска только при первом обращении
+// или если её файлы изменились с момента загрузки. needed - столбцы, нужные запросу
+// (nullptr - вся таблица, как для любой записи). Частично загруженная таблица
+// перечитывается, когда запросу нужен столбец, которого в ней нет
+Table* find_or_load_table(const string& data_dir, const string& table_name, const CustVector<string>* needed = nullptr) {
+    Table* table = tables.get(table_name);
+    if (table && !(table->cache.stamp == table_file_stamp(data_dir, *table))) {
+        // Файлы изменены другим процессом - копия в памяти устарела
+        tables.erase(table_name);
+        table = nullptr;
+    }
+    CustVector<string> wanted;
+    if (table && table->loaded_columns.size > 0) {
+        bool covered = needed != nullptr;
+        for (size_t col = 0; col < table->columns.size && covered; ++col) {
+            if (column_loaded(table, col)) continue;
+            for (size_t i = 0; i < needed->size && covered; ++i) {
+                covered = (*needed)[i] != table->columns[col];
+            }
+        }
+        if (!covered) {
+            // Дочитываем недостающие столбцы вместе с уже разобранными
+            if (needed) {
+                wanted = *needed;
+                for (size_t col = 0; col < table->columns.size; ++col) {
+                    if (column_loaded(table, col)) wanted.push_back(table->columns[col]);
+                }
+                needed = &wanted;
+            }
+            tables.erase(table_name);
+            table = nullptr;
+        }
+    }
+    if (!table) {
+        load_table(data_dir, table_name, needed);
+        table = tables.get(table_name);
+        if (!table) {
+            return nullptr;
+        }
+    }
+    table_cache.touch(table);
+    enforce_cache_budget();
+    return table;
+}
+
+// Таблица для изменения; вызывается под исключительной блокировкой. Между проверкой
+// штампа при загрузке и захватом блокировки другой процесс мог дописать журнал,
+// свернуть или вычистить таблицу, поэтому штамп сверяется ещё раз и устаревшая копия
+// перечитывается. Указатели на таблицу, полученные до блокировки, после вызова недействительны.
+// Если файл таблицы не разбирается, блокировка lock_fd снимается до выброса исключения
+Table* find_locked_table(const string& data_dir, const string& table_name, int lock_fd) {
+    try {
+        return find_or_load_table(data_dir, table_name);
+    } catch (...) {
+        unlock_table(lock_fd);
+        throw;
+    }
+}
+
+// Таблица для проверок перед записью. Загружается под разделяемой блокировкой:
+// писатели перезаписывают основной файл на месте, и чтение без блокировки может
+// застать его наполовину записанным
+Table* find_or_load_table_shared(const string& data_dir, const string& table_name) {
+    int lock_fd = wait_for_unlock(data_dir, table_name, SHARED_LOCK);
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
+    unlock_table(lock_fd);
+    return table;
+}
+
+// Загрузка всех таблиц директории в память (для режима сервера)
+void load_resident_tables(const string& data_dir) {
+    for (const auto& entry : fs::directory_iterator(data_dir)) {
+        string extension = entry.path().extension().string();
+        if (entry.is_regular_file() && (extension == ".json" || extension == ".csv" || extension == ".bin")) {
+            // Каждая таблица - отдельное обращение, чтобы загрузка укладывалась в бюджет кэша
+            table_cache.query_id++;
+            string table_name = entry.path().stem().string();
+            try {
+                find_or_load_table_shared(data_dir, table_name);
+            } catch (const exception& e) {
+                // Повреждённая таблица не мешает обслуживать остальные
+                cerr << "Error: Failed to load table '" << table_name << "': " << e.what() << endl;
+            }
+        }
+    }
+}
+
+
+bool save_table_csv(const string& data_dir, const Table& table) {
+    fs::path file_path = fs::path(data_dir) / (table.name + ".csv");
+    fs::path temp_path = temp_file_path(file_path);
+    ofstream file(temp_path);
+    if (!file.is_open()) {
+        cout << "Failed to open file for writing: " << temp_path << endl;
+        return false;
+    }
+
+    // Запись заголовков с информацией о первичном ключе в конце
+    for (size_t i = 0; i < table.columns.size; ++i) {
+        write_csv_field(file, table.columns[i]);
+        if (i < table.columns.size - 1) file << ",";
+    }
+    // Добавляем информацию о первичном ключе в конец первой строки
+    file << ",\"PRIMARY_KEY:" << table.primary_key << "\"";
+    // Объявленные типы столбцов записываем отдельной ячейкой через ';'
+    if (table.column_types.size > 0) {
+        file << ",\"TYPES:";
+        for (size_t i = 0; i < table.column_types.size; ++i) {
+            if (i > 0) file << ";";
+            file << table.column_types[i];
+        }
+        file << "\"";
+    }
+    file << "\n";
+
+    // Запись данных
+    for (size_t i = 0; i < table.rows.size; ++i) {
+        for (size_t j = 0; j < table.rows[i].size; ++j) {
+            write_csv_field(file, table.rows[i][j]);
+            if (j < table.rows[i].size - 1) {
+                file << ",";
+            }
+        }
+        file << "\n";
+    }
+    file.close();
+    if (!file) {
+        cout << "Failed to write file: " << temp_path << endl;
+        fs::remove(temp_path);
+        return false;
+    }
+    if (!replace_file_durably(temp_path, file_path)) {
+        return false;
+    }
+    cout << "Table saved to " << file_path << endl;
+    return true;
+}
+
+// Сохранение таблицы целиком в том формате, в котором она хранится.
+// false - основной файл не заменён, и журналы ещё нужны
+bool persist_table(const string& data_dir, const Table& table) {
+    ProfileScope profile(STAGE_SAVE);
+    profile_rows(STAGE_SAVE, table.rows.size, table.rows.size);
+    if (table.file_format == "csv") {
+        return save_table_csv(data_dir, table);
+    } else if (table.file_format == "bin") {
+        return save_table_binary(data_dir, table);
+    }
+    // По умолчанию сохраняем в JSON
+    return save_table_json(data_dir, table);
+}
+
+// Очистка журналов после того, как основной файл надёжно заменён целиком.
+// Последовательность ключей записывается раньше, чем удаляется журнал вставок.
+// Сбой до удаления журналов безопасен: их воспроизведение идемпотентно
+// (replay_wal пропускает уже свёрнутые строки, журнал удалений хранит ключи)
+void truncate_wal(const string& data_dir, Table& table) {
+    if (table.wal_fd >= 0) {
+        close(table.wal_fd);
+        table.wal_fd = -1;
+    }
+    if (!write_pk_sequence(data_dir, table.name, table.pk_sequence)) {
+        return;
+    }
+    fs::remove(wal_path(data_dir, table.name));
+    fs::remove(deleted_log_path(data_dir, table.name));
+    table.wal_rows = 0;
+    table.wal_unsynced = 0;
+    table.wal_torn_at = SIZE_MAX;
+}
+
+// Физическое удаление помеченных строк из памяти (VACUUM). Номера строк
+// сдвигаются, поэтому колонки и индексы строятся заново
+void purge_deleted_rows(Table& table) {
+    if (table.deleted_rows == 0) {
+        return;
+    }
+    CustVector<size_t> removed;
+    removed.reserve(table.deleted_rows);
+    for (size_t i = 0; i < table.rows.size; ++i) {
+        if (row_deleted(&table, i)) {
+            removed.push_back(i);
+        }
+    }
+    rebuild_rows(&table, removed);
+    table.deleted_bits = CustVector<uint64_t>();
+    table.deleted_rows = 0;
+    build_typed_columns(&table);
+    build_secondary_indexes(&table);
+    table_cache.resize(&table, estimate_table_bytes(&table));
+}
+
+// Сворачивание журналов: удалённые строки вычищаются, основной файл
+// перезаписывается целиком, журналы вставок и удалений очищаются
+void compact_table(const string& data_dir, Table& table) {
+    purge_deleted_rows(table);
+    if (persist_table(data_dir, table)) {
+        truncate_wal(data_dir, table);
+    }
+}
+
+// Дописывание строк в журнал вставок с учётом политики fsync.
+// Весь пакет уходит одной записью и не более чем одним fsync
+bool append_to_wal(const string& data_dir, Table& table, const CustVector<CustVector<string>>& rows) {
+    ProfileScope profile(STAGE_SAVE);
+    profile_rows(STAGE_SAVE, rows.size, rows.size);
+    if (table.wal_fd < 0) {
+        string path = wal_path(data_dir, table.name).string();
+        table.wal_fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (table.wal_fd < 0) {
+            cerr << "Failed to open WAL file for writing: " << path << endl;
+            return false;
+        }
+    }
+    // Отрезаем недописанный хвост, чтобы новые строки не оказались после мусора
+    if (table.wal_torn_at != SIZE_MAX) {
+        if (ftruncate(table.wal_fd, table.wal_torn_at) != 0) {
+            cerr << "Failed to truncate WAL for table: " << table.name << endl;
+            return false;
+        }
+        table.wal_torn_at = SIZE_MAX;
+    }
+
+    string line;
+    for (size_t r = 0; r < rows.size; ++r) {
+        const CustVector<string>& row = rows[r];
+        line += '[';
+        for (size_t i = 0; i < row.size; ++i) {
+            if (i > 0) line += ',';
+            append_json_string(line, row[i]);
+        }
+        line += "]\n";
+    }
+
+    // Одна запись через O_APPEND, чтобы строки журнала не перемешались с чужими
+    const char* begin = line.data();
+    size_t left = line.size();
+    while (left > 0) {
+        ssize_t written = write(table.wal_fd, begin, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Failed to write WAL for table: " << table.name << endl;
+            return false;
+        }
+        begin += written;
+        left -= written;
+    }
+
+    table.wal_rows += rows.size;
+    table.wal_unsynced += rows.size;
+    if (wal_sync_policy == WAL_SYNC_ALWAYS ||
+        (wal_sync_policy == WAL_SYNC_INTERVAL && table.wal_unsynced >= wal_sync_interval)) {
+        fsync(table.wal_fd);
+        table.wal_unsynced = 0;
+    }
+    return true;
+}
+
+// Дописывание ключей удалённых строк в журнал удалений одной записью
+bool append_to_deleted_log(const string& data_dir, const Table& table, const CustVector<size_t>& rows) {
+    ProfileScope profile(STAGE_SAVE);
+    profile_rows(STAGE_SAVE, rows.size, rows.size);
+    string path = deleted_log_path(data_dir, table.name).string();
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        cerr << "Failed to open deletion log for writing: " << path << endl;
+        return false;
+    }
+
+    // Пишем значения первичного ключа, а не номера строк (см. replay_deleted_log)
+    size_t pk_index = primary_key_index(&table);
+    string lines;
+    for (size_t i = 0; i < rows.size; ++i) {
+        lines += table.rows[rows[i]][pk_index];
+        lines += '\n';
+    }
+    const char* begin = lines.data();
+    size_t left = lines.size();
+    while (left > 0) {
+        ssize_t written = write(fd, begin, left);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            cerr << "Failed to write deletion log for table: " << table.name << endl;
+            close(fd);
+            return false;
+        }
+        begin += written;
+        left -= written;
+    }
+    if (wal_sync_policy != WAL_SYNC_NEVER) {
+        fsync(fd);
+    }
+    close(fd);
+    return true;
+}
+
+// Перевод таблицы в формат format ("csv", "json" или "bin"): таблица
+// записывается целиком, а файлы других форматов удаляются
+void save_in_format(const string& data_dir, const string& table_name, const string& format) {
+    static const char* const formats[] = {"json", "csv", "bin"};
+    string label = format;
+    transform(label.begin(), label.end(), label.begin(), ::toupper);
+    fs::path target_path = fs::path(data_dir) / (table_name + "." + format);
+
+    // Если таблица уже только в этом формате - ничего не делаем
+    bool other_exists = false;
+    for (const char* other : formats) {
+        if (format != other && fs::exists(fs::path(data_dir) / (table_name + "." + other))) {
+            other_exists = true;
+        }
+    }
+    if (fs::exists(target_path) && !other_exists) {
+        cout << "Table is already in " << label << " format: " << target_path << endl;
+        return;
+    }
+    int lock_fd = wait_for_unlock(data_dir, table_name);
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
+    if (!table) {
+        unlock_table(lock_fd);
+        return;
+    }
+
+    // Сначала надёжно записываем таблицу в новом формате и только потом
+    // удаляем файлы других форматов, чтобы сбой не оставил таблицу без файла
+    purge_deleted_rows(*table);
+    string old_format = table->file_format;
+    table->file_format = format;
+    if (!persist_table(data_dir, *table)) {
+        table->file_format = old_format;
+        unlock_table(lock_fd);
+        return;
+    }
+    for (const char* other : formats) {
+        fs::path other_path = fs::path(data_dir) / (table_name + "." + other);
+        if (format != other && fs::exists(other_path)) {
+            fs::remove(other_path);
+            string other_label = other;
+            transform(other_label.begin(), other_label.end(), other_label.begin(), ::toupper);
+            cout << "Removed " << other_label << " file: " << other_path << endl;
+        }
+    }
+    truncate_wal(data_dir, *table);
+    refresh_file_stamp(data_dir, *table);
+    unlock_table(lock_fd);
+    cout << "Table saved as " << label << ": " << target_path << endl;
+}
+
+// Сохранить таблицу в CSV формате (удаляя файлы других форматов)
+void save_as_csv(const string& data_dir, const string& table_name) {
+    save_in_format(data_dir, table_name, "csv");
+}
+
+// Сохранить таблицу в JSON формате (удаляя файлы других форматов)
+void save_as_json(const string& data_dir, const string& table_name) {
+    save_in_format(data_dir, table_name, "json");
+}
+
+// Сохранить таблицу в бинарном формате (удаляя файлы других форматов)
+void save_as_binary(const string& data_dir, const string& table_name) {
+    save_in_format(data_dir, table_name, "bin");
+}
+
+// Функция для сохранения последовательности первичных ключей
+void save_pk_sequence(const Table& table) {
+    ofstream file(table.name + "_pk_sequence.txt");
+    if (!file.is_open()) {
+        cout << "Failed to open file for writing pk_sequence." << endl;
+        return;
+    }
+    file << table.pk_sequence;
+    cout << "Primary key sequence saved to " << table.name << "_pk_sequence.txt" << endl;
+}
+
+// Функция для загрузки последовательности первичных ключей
+void load_pk_sequence(Table& table) {
+    ifstream file(table.name + "_pk_sequence.txt");
+    if (!file.is_open()) {
+        cout << "File not found for pk_sequence." << endl;
+        return;
+    }
+    file >> table.pk_sequence;
+    cout << "Primary key sequence loaded from " << table.name << "_pk_sequence.txt" << endl;
+}
+
+// Вспомогательная функция для добавления уникальной колонки
+void add_column_if_unique(const string& column, CustVector<string>& columns) {
+    if (column.empty() || column == "ID") {
+        return;
+    }
+    
+    // Проверяем уникальность (без unordered_set)
+    for (size_t i = 0; i < columns.size; ++i) {
+        if (columns[i] == column) {
+            return; // Колонка уже существует
+        }
+    }
+    
+    // Добавляем если уникальна
+    columns.push_back(column);
+}
+
+void create_table(const string& data_dir, const string& table_name, const CustVector<string>& columns, const string& primary_key) {
+    // Быстрая проверка файлов
+    const string base_path = data_dir + "/" + table_name;
+    if (fs::exists(base_path + ".json") ||
+        fs::exists(base_path + ".csv") ||
+        fs::exists(base_path + ".bin") ||
+        fs::exists(base_path + "_lock.txt") ||
+        fs::exists(base_path + "_pk_sequence.txt") ||
+        fs::exists(base_path + "_wal.txt") ||
+        fs::exists(base_path + "_deleted.txt")) {
+        cout << "Error: Table files already exist for: " << table_name << endl;
+        return;
+    }
+
+    // Создание таблицы
+    Table new_table(table_name);
+
+    // Добавляем обязательную колонку с именем из primary_key
+    new_table.columns.push_back(primary_key);
+
+    // Обрабатываем колонки
+    CustVector<string> column_definitions;
+    for (size_t i = 0; i < columns.size; ++i) {
+        string column_str = trim(columns[i]);
+
+        // Пропускаем пустые строки
+        if (column_str.empty()) {
+            continue;
+        }
+
+        // Если колонка содержит запятые, разбиваем ее
+        if (column_str.find(',') != string::npos) {
+            size_t start = 0;
+            size_t end = column_str.find(',');
+
+            while (end != string::npos) {
+                column_definitions.push_back(trim(column_str.substr(start, end - start)));
+                start = end + 1;
+                end = column_str.find(',', start);
+            }
+
+            // Последняя колонка после последней запятой
+            column_definitions.push_back(trim(column_str.substr(start)));
+        } else {
+            // Одиночная колонка
+            column_definitions.push_back(column_str);
+        }
+    }
+
+    // Определение колонки может содержать тип: "age INT", "price DOUBLE", "name STRING"
+    CustVector<string> column_types;
+    column_types.push_back("INT");  // Первичный ключ всегда целый
+    bool any_type_declared = false;
+    for (size_t i = 0; i < column_definitions.size; ++i) {
+        string column_name = column_definitions[i];
+        string type_name;
+        size_t space_pos = column_name.find_last_of(" \t");
+        ColumnType type;
+        if (space_pos != string::npos && column_type_from_name(column_name.substr(space_pos + 1), type)) {
+            type_name = column_name.substr(space_pos + 1);
+            column_name = trim(column_name.substr(0, space_pos));
+            any_type_declared = true;
+        }
+
+        size_t columns_before = new_table.columns.size;
+        add_column_if_unique(column_name, new_table.columns);
+        if (new_table.columns.size > columns_before) {
+            column_types.push_back(type_name);
+        }
+    }
+    if (any_type_declared) {
+        new_table.column_types = column_types;
+    }
+
+    // Проверяем, что есть хотя бы одна колонка кроме первичного ключа
+    if (new_table.columns.size <= 1) {
+        cout << "Error: Table must have at least one column besides primary key" << endl;
+        return;
+    }
+
+    const string trimmed_primary_key = trim(primary_key);
+    // Устанавливаем первичный ключ
+    new_table.primary_key = trimmed_primary_key;
+    // Устанавливаем формат по умолчанию (например, JSON)
+    new_table.file_format = "json";
+
+    // Сохраняем в JSON файл
+    save_table_json(data_dir, new_table);
+
+    // Создаем файл блокировки
+    ofstream lock_file(base_path + "_lock.txt");
+    if (lock_file.is_open()) {
+        lock_file << "unlock";
+        lock_file.close();
+    }
+
+    // Создаем файл последовательности первичных ключей
+    ofstream pk_seq_file(base_path + "_pk_sequence.txt");
+    if (pk_seq_file.is_open()) {
+        pk_seq_file << "0";
+        pk_seq_file.close();
+    }
+
+    // Сохраняем в хеш-таблицу
+    Table* saved_table = new Table(new_table);
+    saved_table->file_format = "json"; // Устанавливаем формат
+    build_typed_columns(saved_table);
+    tables.put(table_name, saved_table);
+    refresh_file_stamp(data_dir, *saved_table);
+    table_cache.resize(saved_table, estimate_table_bytes(saved_table));
+
+    // Выводим информацию о созданной таблице
+    cout << "Table '" << table_name << "' created successfully!" << endl;
+}
+
+// Вставка пакета строк одной операцией: блокировка берётся один раз, первичные ключи
+// выделяются сплошным блоком, все строки проверяются до записи, а на диск пакет уходит
+// одной записью журнала (или одной перезаписью файла, если пакет крупный).
+// Значения из value_rows перемещаются. Возвращает число вставленных строк
+size_t insert_rows(const string& data_dir, const string& table_name, CustVector<CustVector<string>>& value_rows) {
+    int lock_fd = wait_for_unlock(data_dir, table_name);
+
+    // Последовательность ключей берём из копии, сверенной с диском под блокировкой,
+    // иначе два процесса выдадут одинаковые ключи
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
+    if (!table) {
+        unlock_table(lock_fd);
+        cout << "Table not found." << endl;
+        return 0;
+    }
+    if (value_rows.size == 0) {
+        unlock_table(lock_fd);
+        return 0;
+    }
+
+    // Находим индекс первичного ключа
+    size_t pk_index = primary_key_index(table);
+    // Блок значений первичного ключа (последовательность восстановлена при загрузке из файла и журнала)
+    int64_t first_pk = table->pk_sequence + 1;
+
+    // Проверяемые колонки с объявленным типом
+    CustVector<size_t> typed_columns;
+    CustVector<TypedColumn> probes;
+    for (size_t i = 0; i < table->column_types.size && i < table->columns.size; ++i) {
+        ColumnType type;
+        // Строковый тип принимает любое значение, проверять его незачем
+        if (i != pk_index && column_type_from_name(table->column_types[i], type) && type != COLUMN_STRING) {
+            typed_columns.push_back(i);
+            probes.emplace_back().type = type;
+        }
+    }
+
+    // Строки собираем в куче: отклонённый пакет не должен оставить ячеек в арене таблицы
+    CustVector<CustVector<string>> new_rows;
+    new_rows.reserve(value_rows.size);
+    for (size_t r = 0; r < value_rows.size; ++r) {
+        CustVector<string>& values = value_rows[r];
+        CustVector<string>& new_row = new_rows.emplace_back();
+        new_row.reserve(table->columns.size);
+
+        // Создаем новую строку
+        for (size_t i = 0; i < table->columns.size; ++i) {
+            if (i == pk_index) {
+                new_row.push_back(to_string(first_pk + static_cast<int64_t>(r)));
+            } else if (i - (i > pk_index ? 1 : 0) < values.size) {
+                string& value = values[i - (i > pk_index ? 1 : 0)];
+                if (!value.empty() && value.front() == '(') value = value.substr(1);
+                if (!value.empty() && value.back() == ')') value = value.substr(0, value.size() - 1);
+                new_row.push_back(std::move(value));
+            } else {
+                new_row.push_back("");
+            }
+        }
+
+        // Проверяем значения столбцов с объявленным типом; пакет вставляется целиком или никак
+        for (size_t k = 0; k < typed_columns.size; ++k) {
+            size_t i = typed_columns[k];
+            probes[k].ints.clear();
+            probes[k].doubles.clear();
+            if (!append_typed_value(probes[k], new_row[i])) {
+                unlock_table(lock_fd);
+                cout << "Error: Value '" << new_row[i] << "' is not a valid " << table->column_types[i]
+                     << " for column '" << table->columns[i] << "'";
+                if (value_rows.size > 1) cout << " (row " << r + 1 << ")";
+                cout << endl;
+                return 0;
+            }
+        }
+    }
+
+    // Крупный пакет сразу свернул бы журнал, поэтому пишем основной файл один раз, минуя журнал
+    size_t count = new_rows.size;
+    bool rewrite = count >= WAL_COMPACT_MIN_ROWS && (table->wal_rows + count) * 2 >= table->rows.size + count;
+    // Небольшие пакеты дописываем в журнал вместо перезаписи всего файла
+    if (!rewrite && !append_to_wal(data_dir, *table, new_rows)) {
+        unlock_table(lock_fd);
+        return 0;
+    }
+
+    size_t added_bytes = 0;
+    table->rows.reserve(table->rows.size + count);
+    for (size_t r = 0; r < count; ++r) {
+        added_bytes += estimate_row_bytes(table, new_rows[r]) + table->columns.size * sizeof(int64_t);
+        CustVector<string>& row = append_row(table);
+        for (size_t i = 0; i < new_rows[r].size; ++i) {
+            row.push_back(std::move(new_rows[r][i]));
+        }
+        append_typed_row(table);
+    }
+    add_rows_to_indexes(table, table->rows.size - count);
+    table->pk_sequence += static_cast<int64_t>(count);
+    table_cache.resize(table, table->cache.bytes + added_bytes);
+
+    // Когда журнал сравнялся по размеру с основным файлом, сворачиваем его
+    if (rewrite || (table->wal_rows >= WAL_COMPACT_MIN_ROWS && table->wal_rows * 2 >= table->rows.size)) {
+        compact_table(data_dir, *table);
+    }
+    refresh_file_stamp(data_dir, *table);
+
+    unlock_table(lock_fd);
+    return count;
+}
+
+// Вывод итога пакетной вставки
+void report_inserted(size_t count, size_t requested) {
+    if (count == 0) {
+        return;
+    }
+    if (requested == 1) {
+        cout << "Data inserted successfully." << endl;
+    } else {
+        cout << count << " rows inserted successfully." << endl;
+    }
+}
+
+void insert_data(const string& data_dir, const string& table_name, const CustVector<string>& values) {
+    CustVector<CustVector<string>> value_rows;
+    value_rows.push_back(values);
+    report_inserted(insert_rows(data_dir, table_name, value_rows), 1);
+}
+
+// Массовая загрузка строк из CSV-файла (COPY table FROM 'file.csv').
+// В каждой записи - значения столбцов без первичного ключа в порядке таблицы;
+// первая запись пропускается, если совпадает с именами этих столбцов
+void copy_from_csv(const string& data_dir, const string& table_name, const string& path) {
+    Table* table = find_or_load_table_shared(data_dir, table_name);
+    if (!table) {
+        return;
+    }
+    MappedFile file;
+    if (!file.open(path)) {
+        cout << "File not found: " << path << endl;
+        return;
+    }
+
+    size_t pk_index = primary_key_index(table);
+    size_t expected = table->columns.size - 1;
+    CustVector<CustVector<string>> value_rows;
+    CsvReader reader(file.data, file.data + file.size);
+    size_t record = 0;
+    while (!reader.at_end()) {
+        CustVector<string>& values = value_rows.emplace_back();
+        reader.read_record(values);
+        ++record;
+        if (record == 1 && values.size == expected) {
+            bool header = true;
+            for (size_t i = 0, v = 0; i < table->columns.size && header; ++i) {
+                if (i == pk_index) continue;
+                header = values[v++] == table->columns[i];
+            }
+            if (header) {
+                value_rows.pop_back();
+                continue;
+            }
+        }
+        if (values.size != expected) {
+            cerr << "Error: Expected " << expected << " values, but got " << values.size
+                 << " in record " << record << " of " << path << endl;
+            return;
+        }
+    }
+    report_inserted(insert_rows(data_dir, table_name, value_rows), value_rows.size);
+}
+
+
+// Скомпилированное условие WHERE. Строка условия разбирается один раз,
+// имена столбцов заменяются индексами, а литералы заранее переводятся в числа.
+struct Condition {
+    enum Kind { ALWAYS_TRUE, ALWAYS_FALSE, AND_NODE, OR_NODE, COMPARE };
+    enum Op { EQ, NE, LT, GT, LE, GE };
+    // Способ сравнения, выбранный по типу колонки при компиляции
+    enum Access {
+        TEXT,  // Сравнение текста ячейки
+        INT_EQUAL,  // =, != по массиву int64
+        INT_RANGE,  // <, >, <=, >= по массиву int64
+        DOUBLE_RANGE,  // <, >, <=, >= по массиву double
+        CODE_EQUAL  // =, != по кодам словаря
+    };
+
+    Kind kind;
+    Condition* left;  // Левый операнд AND/OR
+    Condition* right;  // Правый операнд AND/OR
+    size_t column;  // Индекс столбца для сравнения
+    Op op;  // Оператор сравнения
+    Access access;  // Способ сравнения
+    string value;  // Литерал без кавычек
+    bool value_is_number;  // Удалось ли перевести литерал в число
+    double value_number;  // Числовое значение литерала
+    int64_t value_int;  // Литерал для INT_EQUAL
+    uint32_t value_code;  // Код литерала в словаре для CODE_EQUAL
+
+    Condition(Kind k) : kind(k), left(nullptr), right(nullptr), column(0), op(EQ), access(TEXT),
+                        value_is_number(false), value_number(0), value_int(0), value_code(0) {}
+
+    ~Condition() {
+        delete left;
+        delete right;
+    }
+};
+
+// Перевод строки в число с той же семантикой, что у stod, но без исключений
+bool parse_number(const string& text, double& result) {
+    const char* begin = text.c_str();
+    char* end = nullptr;
+    errno = 0;
+    result = strtod(begin, &end);
+    return end != begin && errno != ERANGE;
+}
+
+// Функция для поиска внешних операторов (игнорируя те, что в скобках)
+size_t find_outer_operator(const string& condition, const string& op) {
+    int bracket_level = 0;
+    for (size_t pos = 0; pos < condition.size(); ++pos) {
+        if (bracket_level == 0 && condition.compare(pos, op.size(), op) == 0) {
+            return pos; // Нашли внешний оператор
+        }
+        if (condition[pos] == '(') ++bracket_level;
+        else if (condition[pos] == ')') --bracket_level;
+    }
+    return string::npos;
+}
+
+// Выбор способа сравнения по типу колонки. Семантика совпадает со сравнением
+// текста: в колонке INT все значения записаны канонически, поэтому
+// равенство текста равносильно равенству чисел
+Condition* choose_access(const Table* table, Condition* node) {
+    if (node->column >= table->typed_columns.size) {
+        return node;
+    }
+    const TypedColumn& column = table->typed_columns[node->column];
+    bool equality = node->op == Condition::EQ || node->op == Condition::NE;
+
+    if (column.type == COLUMN_INT) {
+        if (!equality) {
+            if (node->value_is_number) node->access = Condition::INT_RANGE;
+        } else if (parse_canonical_int(node->value, node->value_int)) {
+            node->access = Condition::INT_EQUAL;
+        } else {
+            // Неканоническая запись не совпадает ни с одним значением колонки
+            Condition::Kind result = node->op == Condition::EQ ? Condition::ALWAYS_FALSE : Condition::ALWAYS_TRUE;
+            delete node;
+            return new Condition(result);
+        }
+    } else if (column.type == COLUMN_DOUBLE) {
+        if (!equality && node->value_is_number) node->access = Condition::DOUBLE_RANGE;
+    } else if (equality) {
+        node->access = Condition::CODE_EQUAL;
+        node->value_code = column.dictionary.find(node->value);
+    }
+    return node;
+}
+
+// Разбор простого условия вида "column op value"
+Condition* compile_simple_condition(const Table* table, const string& condition) {
+    static const regex condition_regex(R"((\w+)\s*(=|<|>|<=|>=|!=)\s*('[^']*'|"[^"]*"|\d+))");
+    smatch match;
+    if (!regex_search(condition, match, condition_regex)) {
+        return new Condition(Condition::ALWAYS_FALSE);
+    }
+
+    string col = match[1];
+    string op = match[2];
+    string val = match[3];
+
+    // Удаление лишних кавычек из значения
+    if (val.front() == '\'' || val.front() == '"') {
+        val = val.substr(1, val.size() - 2);
+    }
+
+    // Ищем столбец; если его нет, условие никогда не выполняется
+    for (size_t j = 0; j < table->columns.size; ++j) {
+        if (table->columns[j] == col) {
+            Condition* node = new Condition(Condition::COMPARE);
+            node->column = j;
+            if (op == "=") node->op = Condition::EQ;
+            else if (op == "!=") node->op = Condition::NE;
+            else if (op == "<") node->op = Condition::LT;
+            else if (op == ">") node->op = Condition::GT;
+            else if (op == "<=") node->op = Condition::LE;
+            else node->op = Condition::GE;
+            node->value = val;
+            node->value_is_number = parse_number(val, node->value_number);
+            return choose_access(table, node);
+        }
+    }
+    return new Condition(Condition::ALWAYS_FALSE);
+}
+
+// Рекурсивный разбор сложного условия в дерево
+Condition* compile_condition(const Table* table, const string& condition) {
+    string cond = trim(condition);
+    if (cond.empty()) return new Condition(Condition::ALWAYS_TRUE);
+
+    // Ищем самый внешний OR (имеет lowest priority)
+    size_t or_pos = find_outer_operator(cond, " OR ");
+    if (or_pos != string::npos) {
+        Condition* node = new Condition(Condition::OR_NODE);
+        node->left = compile_condition(table, cond.substr(0, or_pos));
+        node->right = compile_condition(table, cond.substr(or_pos + 4));
+        return node;
+    }
+
+    // Ищем самый внешний AND (приоритет выше чем OR)
+    size_t and_pos = find_outer_operator(cond, " AND ");
+    if (and_pos != string::npos) {
+        Condition* node = new Condition(Condition::AND_NODE);
+        node->left = compile_condition(table, cond.substr(0, and_pos));
+        node->right = compile_condition(table, cond.substr(and_pos + 5));
+        return node;
+    }
+
+    // Если есть скобки - обрабатываем вложенное выражение
+    if (cond.front() == '(' && cond.back() == ')') {
+        return compile_condition(table, cond.substr(1, cond.size() - 2));
+    }
+
+    // Простое условие без операторов
+    return compile_simple_condition(table, cond);
+}
+
+// Числовое сравнение для операторов <, >, <=, >=
+inline bool compare_numbers(Condition::Op op, double cell_num, double value_num) {
+    switch (op) {
+        case Condition::LT: return cell_num < value_num;
+        case Condition::GT: return cell_num > value_num;
+        case Condition::LE: return cell_num <= value_num;
+        default: return cell_num >= value_num;
+    }
+}
+
+// Сравнение значения ячейки с литералом листа условия
+bool compare_cell(const Condition* cond, const string& cell_value) {
+    if (cond->op == Condition::EQ) return cell_value == cond->value;
+    if (cond->op == Condition::NE) return cell_value != cond->value;
+
+    // Числовое сравнение, если оба значения числа, иначе строковое
+    double cell_num;
+    if (cond->value_is_number && parse_number(cell_value, cell_num)) {
+        return compare_numbers(cond->op, cell_num, cond->value_number);
+    }
+    switch (cond->op) {
+        case Condition::LT: return cell_value < cond->value;
+        case Condition::GT: return cell_value > cond->value;
+        case Condition::LE: return cell_value <= cond->value;
+        default: return cell_value >= cond->value;
+    }
+}
+
+// Проверка скомпилированного условия для строки таблицы
+bool eval_condition(const Condition* cond, const Table* table, size_t row_index) {
+    switch (cond->kind) {
+        case Condition::ALWAYS_TRUE: return true;
+        case Condition::ALWAYS_FALSE: return false;
+        case Condition::AND_NODE:
+            return eval_condition(cond->left, table, row_index) &&
+                   eval_condition(cond->right, table, row_index);
+        case Condition::OR_NODE:
+            return eval_condition(cond->left, table, row_index) ||
+                   eval_condition(cond->right, table, row_index);
+        default:
+            break;
+    }
+
+    const TypedColumn* column = cond->access == Condition::TEXT ? nullptr : &table->typed_columns[cond->column];
+    switch (cond->access) {
+        case Condition::INT_EQUAL:
+            return (column->ints[row_index] == cond->value_int) == (cond->op == Condition::EQ);
+        case Condition::CODE_EQUAL:
+            return (column->codes[row_index] == cond->value_code) == (cond->op == Condition::EQ);
+        case Condition::INT_RANGE:
+            return compare_numbers(cond->op, static_cast<double>(column->ints[row_index]), cond->value_number);
+        case Condition::DOUBLE_RANGE:
+            return compare_numbers(cond->op, column->doubles[row_index], cond->value_number);
+        default:
+            return compare_cell(cond, table->rows[row_index][cond->column]);
+    }
+}
+
+const size_t FILTER_BLOCK_ROWS = 1024;  // Строк в одном блоке пакетной фильтрации
+const size_t FILTER_BLOCK_WORDS = FILTER_BLOCK_ROWS / 64;  // Слов битовой карты блока
+
+// Битовая карта сравнения для хвоста короче 64 значений: бит j - результат pred(j)
+template <typename Pred>
+inline uint64_t scalar_bits(size_t count, Pred pred) {
+    uint64_t word = 0;
+    for (size_t j = 0; j < count; ++j) {
+        word |= static_cast<uint64_t>(pred(j)) << j;
+    }
+    return word;
+}
+
+// Пакетные ядра фильтрации: сравнивают count значений колонки с константой и
+// записывают результат в битовую карту bits (бит j слова j / 64 - значение j).
+// На x86 сравнение идёт по 4-8 значений за инструкцию, иначе - без ветвлений по одному
+
+// x == value для колонки int64
+void filter_int_equal(const int64_t* values, size_t count, int64_t value, uint64_t* bits) {
+    size_t full = count & ~static_cast<size_t>(63);
+#ifdef __AVX2__
+    const __m256i needle = _mm256_set1_epi64x(value);
+#endif
+    for (size_t base = 0; base < full; base += 64) {
+        const int64_t* chunk = values + base;
+#ifdef __AVX2__
+        uint64_t word = 0;
+        for (size_t j = 0; j < 64; j += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk + j));
+            __m256i hits = _mm256_cmpeq_epi64(x, needle);
+            word |= static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(hits))) << j;
+        }
+        bits[base >> 6] = word;
+#else
+        bits[base >> 6] = scalar_bits(64, [chunk, value](size_t j) { return chunk[j] == value; });
+#endif
+    }
+    if (full < count) {
+        const int64_t* chunk = values + full;
+        bits[full >> 6] = scalar_bits(count - full, [chunk, value](size_t j) { return chunk[j] == value; });
+    }
+}
+
+// low <= x <= high для колонки int64
+void filter_int_between(const int64_t* values, size_t count, int64_t low, int64_t high, uint64_t* bits) {
+    size_t full = count & ~static_cast<size_t>(63);
+#ifdef __AVX2__
+    const __m256i low_bound = _mm256_set1_epi64x(low);
+    const __m256i high_bound = _mm256_set1_epi64x(high);
+#endif
+    for (size_t base = 0; base < full; base += 64) {
+        const int64_t* chunk = values + base;
+#ifdef __AVX2__
+        uint64_t word = 0;
+        for (size_t j = 0; j < 64; j += 4) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk + j));
+            // Вне диапазона: low > x или x > high
+            __m256i outside = _mm256_or_si256(_mm256_cmpgt_epi64(low_bound, x), _mm256_cmpgt_epi64(x, high_bound));
+            word |= static_cast<uint64_t>(~_mm256_movemask_pd(_mm256_castsi256_pd(outside)) & 0xF) << j;
+        }
+        bits[base >> 6] = word;
+#else
+        bits[base >> 6] = scalar_bits(64, [chunk, low, high](size_t j) { return (chunk[j] >= low) & (chunk[j] <= high); });
+#endif
+    }
+    if (full < count) {
+        const int64_t* chunk = values + full;
+        bits[full >> 6] = scalar_bits(count - full, [chunk, low, high](size_t j) { return (chunk[j] >= low) & (chunk[j] <= high); });
+    }
+}
+
+// x op value для колонки double (op - одно из <, >, <=, >=; NaN не проходит ни одно)
+void filter_double_compare(const double* values, size_t count, Condition::Op op, double value, uint64_t* bits) {
+    size_t full = count & ~static_cast<size_t>(63);
+    for (size_t base = 0; base < full; base += 64) {
+        const double* chunk = values + base;
+        uint64_t word = 0;
+#if defined(__AVX2__)
+        const __m256d needle = _mm256_set1_pd(value);
+        for (size_t j = 0; j < 64; j += 4) {
+            __m256d x = _mm256_loadu_pd(chunk + j);
+            __m256d hits;
+            switch (op) {
+                case Condition::LT: hits = _mm256_cmp_pd(x, needle, _CMP_LT_OQ); break;
+                case Condition::GT: hits = _mm256_cmp_pd(x, needle, _CMP_GT_OQ); break;
+                case Condition::LE: hits = _mm256_cmp_pd(x, needle, _CMP_LE_OQ); break;
+                default: hits = _mm256_cmp_pd(x, needle, _CMP_GE_OQ); break;
+            }
+            word |= static_cast<uint64_t>(_mm256_movemask_pd(hits)) << j;
+        }
+#elif defined(__SSE2__)
+        const __m128d needle = _mm_set1_pd(value);
+        for (size_t j = 0; j < 64; j += 2) {
+            __m128d x = _mm_loadu_pd(chunk + j);
+            __m128d hits;
+            switch (op) {
+                case Condition::LT: hits = _mm_cmplt_pd(x, needle); break;
+                case Condition::GT: hits = _mm_cmpgt_pd(x, needle); break;
+                case Condition::LE: hits = _mm_cmple_pd(x, needle); break;
+                default: hits = _mm_cmpge_pd(x, needle); break;
+            }
+            word |= static_cast<uint64_t>(_mm_movemask_pd(hits)) << j;
+        }
+#else
+        word = scalar_bits(64, [chunk, op, value](size_t j) { return compare_numbers(op, chunk[j], value); });
+#endif
+        bits[base >> 6] = word;
+    }
+    if (full < count) {
+        const double* chunk = values + full;
+        bits[full >> 6] = scalar_bits(count - full, [chunk, op, value](size_t j) { return compare_numbers(op, chunk[j], value); });
+    }
+}
+
+// x == code для кодов словаря
+void filter_code_equal(const uint32_t* codes, size_t count, uint32_t code, uint64_t* bits) {
+    size_t full = count & ~static_cast<size_t>(63);
+    for (size_t base = 0; base < full; base += 64) {
+        const uint32_t* chunk = codes + base;
+        uint64_t word = 0;
+#if defined(__AVX2__)
+        const __m256i needle = _mm256_set1_epi32(static_cast<int>(code));
+        for (size_t j = 0; j < 64; j += 8) {
+            __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(chunk + j));
+            __m256i hits = _mm256_cmpeq_epi32(x, needle);
+            word |= static_cast<uint64_t>(_mm256_movemask_ps(_mm256_castsi256_ps(hits))) << j;
+        }
+#elif defined(__SSE2__)
+        const __m128i needle = _mm_set1_epi32(static_cast<int>(code));
+        for (size_t j = 0; j < 64; j += 4) {
+            __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(chunk + j));
+            __m128i hits = _mm_cmpeq_epi32(x, needle);
+            word |= static_cast<uint64_t>(_mm_movemask_ps(_mm_castsi128_ps(hits))) << j;
+        }
+#else
+        word = scalar_bits(64, [chunk, code](size_t j) { return chunk[j] == code; });
+#endif
+        bits[base >> 6] = word;
+    }
+    if (full < count) {
+        const uint32_t* chunk = codes + full;
+        bits[full >> 6] = scalar_bits(count - full, [chunk, code](size_t j) { return chunk[j] == code; });
+    }
+}
+
+// Целочисленный диапазон [low, high], равносильный сравнению "x op value" для целых x.
+// Пустой диапазон (low > high) - ни одно значение не подходит
+void int_bounds_for(Condition::Op op, double value, int64_t& low, int64_t& high) {
+    const double limit = 9223372036854775808.0;  // 2^63
+    low = INT64_MIN;
+    high = INT64_MAX;
+    if (std::isnan(value)) {
+        low = 1;
+        high = 0;
+        return;
+    }
+    double bound = (op == Condition::LT || op == Condition::GE) ? ceil(value) : floor(value);
+    bool is_upper = op == Condition::LT || op == Condition::LE;
+    if (bound >= limit) {
+        if (!is_upper) { low = 1; high = 0; }
+        return;
+    }
+    if (bound < -limit) {
+        if (is_upper) { low = 1; high = 0; }
+        return;
+    }
+    int64_t edge = static_cast<int64_t>(bound);
+    switch (op) {
+        case Condition::LT:
+            if (edge == INT64_MIN) { low = 1; high = 0; } else high = edge - 1;
+            break;
+        case Condition::LE: high = edge; break;
+        case Condition::GT:
+            if (edge == INT64_MAX) { low = 1; high = 0; } else low = edge + 1;
+            break;
+        default: low = edge; break;
+    }
+}
+
+// Обнуление битов за пределами count значений
+inline void clear_tail_bits(uint64_t* bits, size_t count) {
+    if (count & 63) {
+        bits[count >> 6] &= (static_cast<uint64_t>(1) << (count & 63)) - 1;
+    }
+}
+
+// Сравнение текста на равенство: сначала длина и первый символ, затем memcmp
+inline bool text_equals(const string& cell, const string& value) {
+    return cell.size() == value.size() && (value.empty() || (cell[0] == value[0] &&
+           memcmp(cell.data(), value.data(), value.size()) == 0));
+}
+
+// Пакетная проверка условия для строк [begin, begin + count), count <= FILTER_BLOCK_ROWS.
+// Листья считаются ядрами над колонками, AND/OR объединяют битовые карты по словам
+void filter_block(const Condition* cond, const Table* table, size_t begin, size_t count, uint64_t* bits) {
+    size_t words = (count + 63) >> 6;
+    switch (cond->kind) {
+        case Condition::ALWAYS_TRUE:
+            for (size_t w = 0; w < words; ++w) bits[w] = ~static_cast<uint64_t>(0);
+            clear_tail_bits(bits, count);
+            return;
+        case Condition::ALWAYS_FALSE:
+            for (size_t w = 0; w < words; ++w) bits[w] = 0;
+            return;
+        case Condition::AND_NODE:
+        case Condition::OR_NODE: {
+            filter_block(cond->left, table, begin, count, bits);
+            // Правую часть можно не считать, если левая уже решила весь блок
+            size_t matched = 0;
+            for (size_t w = 0; w < words; ++w) {
+                matched += __builtin_popcountll(bits[w]);
+            }
+            bool is_and = cond->kind == Condition::AND_NODE;
+            if ((is_and && matched == 0) || (!is_and && matched == count)) {
+                return;
+            }
+            uint64_t right[FILTER_BLOCK_WORDS];
+            filter_block(cond->right, table, begin, count, right);
+            for (size_t w = 0; w < words; ++w) {
+                bits[w] = is_and ? (bits[w] & right[w]) : (bits[w] | right[w]);
+            }
+            return;
+        }
+        default:
+            break;
+    }
+
+    bool negate = cond->op == Condition::NE;
+    switch (cond->access) {
+        case Condition::INT_EQUAL:
+            filter_int_equal(table->typed_columns[cond->column].ints.data + begin, count, cond->value_int, bits);
+            break;
+        case Condition::CODE_EQUAL:
+            filter_code_equal(table->typed_columns[cond->column].codes.data + begin, count, cond->value_code, bits);
+            break;
+        case Condition::INT_RANGE: {
+            int64_t low, high;
+            int_bounds_for(cond->op, cond->value_number, low, high);
+            filter_int_between(table->typed_columns[cond->column].ints.data + begin, count, low, high, bits);
+            break;
+        }
+        case Condition::DOUBLE_RANGE:
+            filter_double_compare(table->typed_columns[cond->column].doubles.data + begin, count, cond->op, cond->value_number, bits);
+            break;
+        default: {
+            static const string empty_value;
+            const CustVector<string>* rows = &table->rows[begin];
+            size_t column = cond->column;
+            for (size_t base = 0; base < count; base += 64) {
+                size_t n = min(static_cast<size_t>(64), count - base);
+                const CustVector<string>* chunk = rows + base;
+                if (cond->op == Condition::EQ || negate) {
+                    bits[base >> 6] = scalar_bits(n, [chunk, column, cond](size_t j) {
+                        return text_equals(column < chunk[j].size ? chunk[j][column] : empty_value, cond->value);
+                    });
+                } else {
+                    bits[base >> 6] = scalar_bits(n, [chunk, column, cond](size_t j) {
+                        return compare_cell(cond, column < chunk[j].size ? chunk[j][column] : empty_value);
+                    });
+                }
+            }
+            break;
+        }
+    }
+    if (negate) {
+        for (size_t w = 0; w < words; ++w) bits[w] = ~bits[w];
+        clear_tail_bits(bits, count);
+    }
+}
+
+// Пакетный просмотр строк [begin, end): условие считается блоками битовых карт,
+// удалённые строки вычитаются по словам, номера подходящих строк дописываются в result
+void filter_rows(const Table* table, const Condition* cond, size_t begin, size_t end, CustVector<size_t>& result) {
+    uint64_t bits[FILTER_BLOCK_WORDS];
+    for (size_t block = begin; block < end; block += FILTER_BLOCK_ROWS) {
+        size_t count = min(FILTER_BLOCK_ROWS, end - block);
+        filter_block(cond, table, block, count, bits);
+        for (size_t w = 0; w < (count + 63) >> 6; ++w) {
+            uint64_t word = bits[w];
+            size_t first = block + (w << 6);
+            // Начало блока кратно 64, поэтому слово карты удалений совпадает со словом блока
+            size_t deleted_word = first >> 6;
+            if (deleted_word < table->deleted_bits.size) {
+                word &= ~table->deleted_bits[deleted_word];
+            }
+            while (word != 0) {
+                result.push_back(first + __builtin_ctzll(word));
+                word &= word - 1;
+            }
+        }
+    }
+}
+
+// Диапазон ключей [low, high], удовлетворяющих сравнению "ключ op value".
+// Границы приводятся к размеру индекса, чтобы не было переполнения
+void key_range_for(Condition::Op op, double value, size_t key_count, int64_t& low, int64_t& high) {
+    double low_bound = 0;
+    double high_bound = static_cast<double>(key_count) - 1;
+    switch (op) {
+        case Condition::EQ: low_bound = max(low_bound, value); high_bound = min(high_bound, value); break;
+        case Condition::LT: high_bound = min(high_bound, ceil(value) - 1); break;
+        case Condition::LE: high_bound = min(high_bound, floor(value)); break;
+        case Condition::GT: low_bound = max(low_bound, floor(value) + 1); break;
+        default: low_bound = max(low_bound, ceil(value)); break;
+    }
+    low = static_cast<int64_t>(ceil(low_bound));
+    high = static_cast<int64_t>(floor(high_bound));
+}
+
+// Поиск кандидатов по вторичным индексам столбца условия
+bool plan_secondary_lookup(const Table* table, const Condition* cond, CustVector<size_t>& candidates) {
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        const SecondaryIndex* index = table->indexes[i];
+        if (index->column != cond->column) {
+            continue;
+        }
+
+        // Хеш-индекс: равенство текста значения
+        if (!index->sorted && cond->op == Condition::EQ) {
+            for (size_t row = index->hash.find(cond->value); row != NO_ROW; row = index->hash.next_match(row, cond->value)) {
+                candidates.push_back(row);
+            }
+            sort(candidates.data, candidates.data + candidates.size);
+            return true;
+        }
+        if (!index->sorted) {
+            continue;
+        }
+
+        // Упорядоченный индекс: бинарный поиск границ диапазона
+        const TypedColumn& column = table->typed_columns[index->column];
+        const size_t* begin = index->order.data;
+        const size_t* end = index->order.data + index->order.size;
+        const size_t* low = begin;
+        const size_t* high = end;
+        if (index->key_type == COLUMN_STRING && cond->op == Condition::EQ) {
+            low = lower_bound(begin, end, cond->value, [table, index](size_t row, const string& value) {
+                return table->rows[row][index->column] < value; });
+            high = upper_bound(low, end, cond->value, [table, index](const string& value, size_t row) {
+                return value < table->rows[row][index->column]; });
+        } else if (index->key_type != COLUMN_STRING && index->key_type == column.type &&
+                   (cond->access == Condition::INT_EQUAL || cond->access == Condition::INT_RANGE || cond->access == Condition::DOUBLE_RANGE)) {
+            if (cond->op == Condition::NE) {
+                continue;
+            }
+            double value = cond->access == Condition::INT_EQUAL ? static_cast<double>(cond->value_int) : cond->value_number;
+            auto key_of = [&column, index](size_t row) {
+                return index->key_type == COLUMN_INT ? static_cast<double>(column.ints[row]) : column.doubles[row];
+            };
+            // NaN стоят в конце индекса и ни одному сравнению не удовлетворяют; кандидаты перепроверяются
+            auto key_less = [&key_of](size_t row, double v) { return double_less(key_of(row), v); };
+            auto value_less = [&key_of](double v, size_t row) { return double_less(v, key_of(row)); };
+            if (cond->op == Condition::EQ || cond->op == Condition::GE) low = lower_bound(begin, end, value, key_less);
+            if (cond->op == Condition::GT) low = upper_bound(begin, end, value, value_less);
+            if (cond->op == Condition::EQ || cond->op == Condition::LE) high = upper_bound(begin, end, value, value_less);
+            if (cond->op == Condition::LT) high = lower_bound(begin, end, value, key_less);
+        } else {
+            continue;
+        }
+
+        // Малоизбирательный диапазон дешевле проверить обычным просмотром
+        if (static_cast<size_t>(high - low) + index->pending.size > table->rows.size / 4 + 16) {
+            return false;
+        }
+        for (const size_t* it = low; it < high; ++it) {
+            candidates.push_back(*it);
+        }
+        // Строки буфера ещё не упорядочены; условие проверит каждую
+        for (size_t k = 0; k < index->pending.size; ++k) {
+            candidates.push_back(index->pending[k]);
+        }
+        sort(candidates.data, candidates.data + candidates.size);
+        return true;
+    }
+    return false;
+}
+
+// Поиск строк-кандидатов по индексу первичного ключа или вторичным индексам.
+// Возвращает false, если условие нельзя сузить индексом и нужен полный просмотр
+bool plan_index_lookup(const Table* table, const Condition* cond, CustVector<size_t>& candidates) {
+    if (cond->kind == Condition::ALWAYS_FALSE) {
+        return true;
+    }
+    if (cond->kind == Condition::AND_NODE) {
+        return plan_index_lookup(table, cond->left, candidates) ||
+               plan_index_lookup(table, cond->right, candidates);
+    }
+    if (cond->kind != Condition::COMPARE) {
+        return false;
+    }
+    if (!table->pk_index_valid || cond->column != primary_key_index(table)) {
+        return plan_secondary_lookup(table, cond, candidates);
+    }
+
+    int64_t low;
+    int64_t high;
+    if (cond->access == Condition::INT_EQUAL && cond->op == Condition::EQ) {
+        low = high = cond->value_int;
+    } else if (cond->access == Condition::INT_RANGE) {
+        key_range_for(cond->op, cond->value_number, table->pk_rows.size, low, high);
+    } else {
+        return false;
+    }
+
+    // Широкий диапазон дешевле проверить обычным просмотром
+    if (high >= low && static_cast<size_t>(high - low) > table->rows.size / 4 + 16) {
+        return false;
+    }
+    for (int64_t key = max<int64_t>(low, 0); key <= high && key < static_cast<int64_t>(table->pk_rows.size); ++key) {
+        size_t row = table->pk_rows[key];
+        if (row != NO_ROW) {
+            candidates.push_back(row);
+        }
+    }
+    // Ключи не обязаны идти в порядке строк, а вывод должен сохранять порядок таблицы
+    sort(candidates.data, candidates.data + candidates.size);
+    return true;
+}
+
+// Номера строк, удовлетворяющих условию, в порядке следования в таблице.
+// По возможности используется индекс, иначе выполняется полный просмотр
+// Число потоков для просмотра таблиц (--threads), 0 - по числу ядер
+size_t scan_threads = 0;
+
+// Таблицы меньше порога просматриваются в одном потоке: раздача задач дороже самого просмотра
+const size_t PARALLEL_SCAN_MIN_ROWS = 65536;
+const size_t SCAN_CHUNK_ROWS = 16384;  // Размер куска строк для одного потока
+
+// Пул потоков для параллельного просмотра. Задача делится на куски, которые
+// рабочие потоки и вызывающий поток разбирают по атомарному счётчику
+class ThreadPool {
+public:
+    explicit ThreadPool(size_t thread_count)
+        : job(nullptr), job_size(0), generation(0), active(0), stopping(false), next_task(0), pending(0) {
+        for (size_t i = 1; i < thread_count; ++i) {
+            workers.emplace_back([this]() { worker_loop(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            lock_guard<mutex> guard(state_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (size_t i = 0; i < workers.size; ++i) {
+            workers[i].join();
+        }
+    }
+
+    size_t thread_count() const {
+        return workers.size + 1;
+    }
+
+    // Выполнение task(i) для каждого i из [0, task_count). Возвращается, когда готовы все куски
+    void run(size_t task_count, const function<void(size_t)>& task) {
+        lock_guard<mutex> run_guard(run_mutex);
+        {
+            // Опоздавшие потоки прошлой задачи должны выйти, прежде чем её поля будут заменены
+            unique_lock<mutex> guard(state_mutex);
+            done.wait(guard, [this]() { return active == 0; });
+            job = &task;
+            job_size = task_count;
+            next_task = 0;
+            pending = task_count;
+            ++generation;
+        }
+        wake.notify_all();
+        drain();
+        unique_lock<mutex> guard(state_mutex);
+        done.wait(guard, [this]() { return pending == 0 && active == 0; });
+        job = nullptr;
+    }
+
+private:
+    void worker_loop() {
+        size_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> guard(state_mutex);
+                wake.wait(guard, [&]() { return stopping || generation != seen; });
+                if (stopping) return;
+                seen = generation;
+                ++active;
+            }
+            drain();
+            {
+                lock_guard<mutex> guard(state_mutex);
+                --active;
+            }
+            done.notify_all();
+        }
+    }
+
+    void drain() {
+        while (true) {
+            size_t task = next_task.fetch_add(1);
+            if (task >= job_size) return;
+            (*job)(task);
+            if (pending.fetch_sub(1) == 1) {
+                lock_guard<mutex> guard(state_mutex);
+                done.notify_all();
+            }
+        }
+    }
+
+    CustVector<thread> workers;  // Рабочие потоки (вызывающий поток - ещё один)
+    mutex run_mutex;  // Одновременно выполняется одна задача
+    mutex state_mutex;  // Защищает поля задачи и счётчик active
+    condition_variable wake;  // Появилась задача или пул останавливается
+    condition_variable done;  // Куски задачи закончились или поток вышел из неё
+    const function<void(size_t)>* job;  // Текущая задача
+    size_t job_size;  // Число кусков текущей задачи
+    size_t generation;  // Номер текущей задачи
+    size_t active;  // Рабочие потоки, занятые текущей задачей
+    bool stopping;  // Пул останавливается
+    atomic<size_t> next_task;  // Следующий свободный кусок
+    atomic<size_t> pending;  // Невыполненные куски
+};
+
+// Общий пул просмотра, создаётся при первом обращении
+ThreadPool& scan_pool() {
+    static ThreadPool pool(scan_threads > 0 ? scan_threads : max(1u, thread::hardware_concurrency()));
+    return pool;
+}
+
+// Полный просмотр таблицы. Большая таблица делится на куски, условие по кускам
+// проверяется в пуле потоков, а номера строк склеиваются в исходном порядке
+void scan_matching_rows(const Table* table, const Condition* cond, CustVector<size_t>& result) {
+    size_t row_count = table->rows.size;
+    if (row_count < PARALLEL_SCAN_MIN_ROWS || scan_pool().thread_count() == 1) {
+        filter_rows(table, cond, 0, row_count, result);
+        return;
+    }
+
+    size_t chunk_count = (row_count + SCAN_CHUNK_ROWS - 1) / SCAN_CHUNK_ROWS;
+    CustVector<CustVector<size_t>> chunk_rows;
+    chunk_rows.reserve(chunk_count);
+    for (size_t c = 0; c < chunk_count; ++c) {
+        chunk_rows.emplace_back();
+    }
+    scan_pool().run(chunk_count, [&](size_t c) {
+        filter_rows(table, cond, c * SCAN_CHUNK_ROWS, min(row_count, (c + 1) * SCAN_CHUNK_ROWS), chunk_rows[c]);
+    });
+
+    size_t total = result.size;
+    for (size_t c = 0; c < chunk_count; ++c) {
+        total += chunk_rows[c].size;
+    }
+    result.reserve(total);
+    for (size_t c = 0; c < chunk_count; ++c) {
+        for (size_t k = 0; k < chunk_rows[c].size; ++k) {
+            result.push_back(chunk_rows[c][k]);
+        }
+    }
+}
+
+void find_matching_rows(const Table* table, const Condition* cond, CustVector<size_t>& result) {
+    ProfileScope profile(STAGE_FILTER);
+    size_t found_before = result.size;
+    CustVector<size_t> candidates;
+    if (plan_index_lookup(table, cond, candidates)) {
+        for (size_t i = 0; i < candidates.size; ++i) {
+            if (!row_deleted(table, candidates[i]) && eval_condition(cond, table, candidates[i])) {
+                result.push_back(candidates[i]);
+            }
+        }
+        profile_rows(STAGE_FILTER, candidates.size, result.size - found_before);
+        return;
+    }
+    scan_matching_rows(table, cond, result);
+    profile_rows(STAGE_FILTER, table->rows.size, result.size - found_before);
+}
+
+// Просмотр строк, подходящих под условие, кусками в порядке строк. consume получает
+// номера строк очередного куска и возвращает false, если дальше смотреть не нужно.
+// Куски проверяются волнами по числу потоков пула, поэтому ранняя остановка
+// (LIMIT без ORDER BY) не ждёт просмотра всей таблицы
+void for_each_matching_chunk(const Table* table, const Condition* cond, const function<bool(const CustVector<size_t>&)>& consume) {
+    CustVector<size_t> candidates;
+    CustVector<size_t> matched;
+    bool indexed;
+    {
+        ProfileScope profile(STAGE_FILTER);
+        indexed = plan_index_lookup(table, cond, candidates);
+        if (indexed) {
+            for (size_t i = 0; i < candidates.size; ++i) {
+                if (!row_deleted(table, candidates[i]) && eval_condition(cond, table, candidates[i])) {
+                    matched.push_back(candidates[i]);
+                }
+            }
+            profile_rows(STAGE_FILTER, candidates.size, matched.size);
+        }
+    }
+    if (indexed) {
+        consume(matched);
+        return;
+    }
+
+    size_t row_count = table->rows.size;
+    size_t chunk_count = (row_count + SCAN_CHUNK_ROWS - 1) / SCAN_CHUNK_ROWS;
+    size_t wave = row_count < PARALLEL_SCAN_MIN_ROWS ? 1 : scan_pool().thread_count();
+    CustVector<CustVector<size_t>> chunk_rows;
+    chunk_rows.reserve(wave);
+    for (size_t c = 0; c < wave; ++c) {
+        chunk_rows.emplace_back();
+    }
+    for (size_t first = 0; first < chunk_count; first += wave) {
+        size_t count = min(wave, chunk_count - first);
+        {
+            ProfileScope profile(STAGE_FILTER);
+            auto scan_chunk = [&](size_t c) {
+                size_t begin = (first + c) * SCAN_CHUNK_ROWS;
+                chunk_rows[c].clear();
+                filter_rows(table, cond, begin, min(row_count, begin + SCAN_CHUNK_ROWS), chunk_rows[c]);
+            };
+            if (count == 1) {
+                scan_chunk(0);
+            } else {
+                scan_pool().run(count, scan_chunk);
+            }
+            size_t found = 0;
+            for (size_t c = 0; c < count; ++c) found += chunk_rows[c].size;
+            profile_rows(STAGE_FILTER, min(row_count, (first + count) * SCAN_CHUNK_ROWS) - first * SCAN_CHUNK_ROWS, found);
+        }
+        for (size_t c = 0; c < count; ++c) {
+            if (!consume(chunk_rows[c])) {
+                return;
+            }
+        }
+    }
+}
+
+void delete_data(const string& data_dir, const string& table_name, const string& condition) {
+    int lock_fd = wait_for_unlock(data_dir, table_name);
+
+    // Совпадения ищем в копии, сверенной с диском под блокировкой: строки, вставленные
+    // или вычищенные другим процессом, иначе не попали бы в условие или сдвинули номера
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
+    if (!table) {
+        unlock_table(lock_fd);
+        cout << "Table not found." << endl;
+        return;
+    }
+
+    if (table->rows.size == table->deleted_rows) {
+        unlock_table(lock_fd);
+        cout << "Table is empty. Nothing to delete." << endl;
+        return;
+    }
+
+    Condition* compiled = compile_condition(table, condition);
+    CustVector<size_t> matched;
+    find_matching_rows(table, compiled, matched);
+    delete compiled;
+
+    if (matched.size == 0) {
+        unlock_table(lock_fd);
+        cout << "No rows matched the condition. Nothing to delete." << endl;
         return;
     }
 
-    // Создание таблицы
-    Table new_table(table_name);
+    // Строки только помечаются удалёнными: номера строк и первичные ключи не меняются,
+    // а на диск дописываются лишь ключи удалённых строк
+    if (!append_to_deleted_log(data_dir, *table, matched)) {
+        unlock_table(lock_fd);
+        return;
+    }
+    for (size_t i = 0; i < matched.size; ++i) {
+        mark_row_deleted(table, matched[i]);
+    }
 
-    // Добавляем обязательную колонку с именем из primary_key
-    new_table.columns.push_back(primary_key);
+    // Когда удалённых строк не меньше половины, таблица вычищается и перезаписывается,
+    // поэтому суммарная стоимость перезаписей линейна
+    if (table->deleted_rows * 2 >= table->rows.size) {
+        compact_table(data_dir, *table);
+    }
+    refresh_file_stamp(data_dir, *table);
 
-    // Обрабатываем колонки
-    for (size_t i = 0; i < columns.size; ++i) {
-        string column_str = trim(columns[i]);
+    unlock_table(lock_fd);
+    cout << "Successfully deleted " << matched.size
+         << " rows from table '" << table_name << "'" << endl;
+}
 
-        // Пропускаем пустые строки
-        if (column_str.empty()) {
+// Номер столбца таблицы по имени вида table.column или column (NO_ROW - не найден)
+size_t find_table_column(const Table* table, const string& name) {
+    size_t dot_pos = name.find('.');
+    string column = dot_pos != string::npos ? name.substr(dot_pos + 1) : name;
+    for (size_t k = 0; k < table->columns.size; ++k) {
+        if (table->columns[k] == column) return k;
+    }
+    return NO_ROW;
+}
+
+// Индексы колонок таблицы, которые попадают в вывод соединения
+void resolve_join_output(const Table* table, const CustVector<string>& selected_columns, CustVector<size_t>& output) {
+    for (size_t i = 0; i < selected_columns.size; ++i) {
+        const string& full_col_name = selected_columns[i];
+        size_t dot_pos = full_col_name.find(".");
+        if (full_col_name.substr(0, dot_pos) != table->name) {
             continue;
         }
-
-        // Если колонка содержит запятые, разбиваем ее
-        if (column_str.find(',') != string::npos) {
-            size_t start = 0;
-            size_t end = column_str.find(',');
-
-            while (end != string::npos) {
-                string single_column = trim(column_str.substr(start, end - start));
-                add_column_if_unique(single_column, new_table.columns);
-                start = end + 1;
-                end = column_str.find(',', start);
+        string column_name_part = full_col_name.substr(dot_pos + 1);
+        for (size_t k = 0; k < table->columns.size; ++k) {
+            if (table->columns[k] == column_name_part) {
+                output.push_back(k);
+                break;
             }
-
-            // Последняя колонка после последней запятой
-            string last_column = trim(column_str.substr(start));
-            add_column_if_unique(last_column, new_table.columns);
-        } else {
-            // Одиночная колонка
-            add_column_if_unique(column_str, new_table.columns);
         }
     }
+}
+// Создание вторичного индекса по столбцу таблицы
+void create_index(const string& data_dir, const string& index_name, const string& table_name, const string& column_name, bool sorted) {
+    int lock_fd = wait_for_unlock(data_dir, table_name);
 
-    // Проверяем, что есть хотя бы одна колонка кроме первичного ключа
-    if (new_table.columns.size <= 1) {
-        cout << "Error: Table must have at least one column besides primary key" << endl;
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
+    if (!table) {
+        unlock_table(lock_fd);
+        cout << "Table not found." << endl;
         return;
     }
 
-    const string trimmed_primary_key = trim(primary_key);
-    // Устанавливаем первичный ключ
-    new_table.primary_key = trimmed_primary_key;
-    // Устанавливаем формат по умолчанию (например, JSON)
-    new_table.file_format = "json";
+    size_t column = table->columns.size;
+    for (size_t i = 0; i < table->columns.size; ++i) {
+        if (table->columns[i] == column_name) {
+            column = i;
+            break;
+        }
+    }
+    if (column == table->columns.size) {
+        unlock_table(lock_fd);
+        cout << "Error: Column '" << column_name << "' not found in table '" << table_name << "'" << endl;
+        return;
+    }
+    for (size_t i = 0; i < table->indexes.size; ++i) {
+        if (table->indexes[i]->name == index_name) {
+            unlock_table(lock_fd);
+            cout << "Error: Index '" << index_name << "' already exists on table '" << table_name << "'" << endl;
+            return;
+        }
+    }
 
-    // Сохраняем в JSON файл
-    save_table_json(data_dir, new_table);
+    SecondaryIndex* index = new SecondaryIndex();
+    index->name = index_name;
+    index->column = column;
+    index->sorted = sorted;
+    build_secondary_index(table, index);
+    table->indexes.push_back(index);
+    save_index_definitions(data_dir, table);
 
-    // Создаем файл блокировки
-    ofstream lock_file(base_path + "_lock.txt");
-    if (lock_file.is_open()) {
-        lock_file << "unlock";
-        lock_file.close();
-    }
+    unlock_table(lock_fd);
+    cout << "Index '" << index_name << "' created on " << table_name << "(" << column_name << ")." << endl;
+}
 
-    // Создаем файл последовательности первичных ключей
-    ofstream pk_seq_file(base_path + "_pk_sequence.txt");
-    if (pk_seq_file.is_open()) {
-        pk_seq_file << "0";
-        pk_seq_file.close();
+// Сворачивание журнала вставок в основной файл таблицы по запросу
+void compact_data(const string& data_dir, const string& table_name) {
+    int lock_fd = wait_for_unlock(data_dir, table_name);
+
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
+    if (!table) {
+        unlock_table(lock_fd);
+        cout << "Table not found." << endl;
+        return;
     }
 
-    // Сохраняем в хеш-таблицу
-    Table* saved_table = new Table(new_table);
-    saved_table->file_format = "json"; // Устанавливаем формат
-    tables.put(table_name, reinterpret_cast<void*>(saved_table));
+    size_t folded_rows = table->wal_rows;
+    compact_table(data_dir, *table);
+    refresh_file_stamp(data_dir, *table);
 
-    // Выводим информацию о созданной таблице
-    cout << "Table '" << table_name << "' created successfully!" << endl;
+    unlock_table(lock_fd);
+    cout << "Table '" << table_name << "' compacted (" << folded_rows << " logged rows folded)." << endl;
 }
 
-void insert_data(const string& data_dir, const string& table_name, const CustVector<string>& values) {
-    wait_for_unlock(data_dir, table_name);
+// Физическое удаление помеченных строк по запросу (VACUUM)
+void vacuum_data(const string& data_dir, const string& table_name) {
+    int lock_fd = wait_for_unlock(data_dir, table_name);
 
-    Table* table = reinterpret_cast<Table*>(tables.get(table_name));
+    Table* table = find_locked_table(data_dir, table_name, lock_fd);
     if (!table) {
-        unlock_table(data_dir, table_name);
+        unlock_table(lock_fd);
         cout << "Table not found." << endl;
         return;
     }
 
-    // Чтение текущей последовательности первичных ключей
-    size_t pk_sequence = read_pk_sequence(data_dir, table_name);
-    string pk_value = to_string(pk_sequence + 1);
+    size_t removed_rows = table->deleted_rows;
+    compact_table(data_dir, *table);
+    refresh_file_stamp(data_dir, *table);
+
+    unlock_table(lock_fd);
+    cout << "Table '" << table_name << "' vacuumed (" << removed_rows << " deleted rows removed)." << endl;
+}
 
-    CustVector<string> new_row;
+// Приёмник строк результата. Строки сериализуются в общий буфер, который
+// уходит в поток вывода крупными блоками, а не по ячейке
+class ResultSink {
+public:
+    static constexpr size_t FLUSH_BYTES = 1 << 20;  // Размер буфера, после которого он сбрасывается
 
-    // Находим индекс первичного ключа
-    size_t pk_index = 0;
-    for (size_t i = 0; i < table->columns.size; ++i) {
-        if (table->columns[i] == table->primary_key) {
-            pk_index = i;
-            break;
-        }
+    ResultSink(ostream& out, OutputFormat format) : out_(out), format_(format), cell_index_(0) {}
+
+    ~ResultSink() {
+        flush();
     }
 
-    // Создаем новую строку
-    for (size_t i = 0; i < table->columns.size; ++i) {
-        if (i == pk_index) {
-            new_row.push_back(pk_value);
-        } else {
-            if (i - (i > pk_index ? 1 : 0) < values.size) {
-                string value = values[i - (i > pk_index ? 1 : 0)];
-                if (value.front() == '(') value = value.substr(1);
-                if (value.back() == ')') value = value.substr(0, value.size() - 1);
-                new_row.push_back(value);
+    // Заголовок результата. Имена вида table.column в TSV и CSV выводятся без имени таблицы,
+    // а в JSON-строках используются целиком как ключи
+    void header(const CustVector<string>& column_names) {
+        for (size_t i = 0; i < column_names.size; ++i) {
+            size_t dot_pos = column_names[i].find('.');
+            string short_name = dot_pos != string::npos ? column_names[i].substr(dot_pos + 1) : column_names[i];
+            if (format_ == OUTPUT_JSONL) {
+                string key;
+                append_json_string(key, column_names[i]);
+                keys_.push_back(key + ":");
+            } else if (format_ == OUTPUT_CSV) {
+                if (i > 0) buffer_ += ',';
+                append_csv_field(buffer_, short_name);
             } else {
-                new_row.push_back("");
+                buffer_ += short_name;
+                buffer_ += '\t';
             }
         }
+        if (format_ == OUTPUT_TSV) {
+            buffer_ += '\n';
+            buffer_.append(column_names.size * 10, '-');
+            buffer_ += '\n';
+        } else if (format_ == OUTPUT_CSV) {
+            buffer_ += '\n';
+        }
     }
 
-    table->rows.push_back(new_row);
+    void begin_row() {
+        cell_index_ = 0;
+        if (format_ == OUTPUT_JSONL) buffer_ += '{';
+    }
 
-    // Обновление последовательности первичных ключей
-    write_pk_sequence(data_dir, table_name, pk_sequence + 1);
+    void cell(const string& value) {
+        if (format_ == OUTPUT_JSONL) {
+            if (cell_index_ > 0) buffer_ += ',';
+            buffer_ += keys_[cell_index_];
+            append_json_string(buffer_, value);
+        } else if (format_ == OUTPUT_CSV) {
+            if (cell_index_ > 0) buffer_ += ',';
+            append_csv_field(buffer_, value);
+        } else {
+            buffer_ += value;
+            buffer_ += '\t';
+        }
+        ++cell_index_;
+    }
 
-    // Сохраняем в том же формате, в котором была загружена таблица
-    if (table->file_format == "json") {
-        save_table_json(data_dir, *table);
-    } else if (table->file_format == "csv") {
-        save_table_csv(data_dir, *table);
-    } else {
-        // По умолчанию сохраняем в JSON
-        save_table_json(data_dir, *table);
+    // Отсутствующее значение: NULL в TSV, пустое поле в CSV, null в JSON
+    void null_cell() {
+        if (format_ == OUTPUT_JSONL) {
+            if (cell_index_ > 0) buffer_ += ',';
+            buffer_ += keys_[cell_index_];
+            buffer_ += "null";
+        } else if (format_ == OUTPUT_CSV) {
+            if (cell_index_ > 0) buffer_ += ',';
+        } else {
+            buffer_ += "NULL\t";
+        }
+        ++cell_index_;
+    }
+
+    void end_row() {
+        if (format_ == OUTPUT_JSONL) buffer_ += '}';
+        buffer_ += '\n';
+        if (buffer_.size() >= FLUSH_BYTES) {
+            flush();
+        }
+    }
+
+    void flush() {
+        ProfileScope profile(STAGE_OUTPUT);
+        if (!buffer_.empty()) {
+            out_.write(buffer_.data(), buffer_.size());
+            buffer_.clear();
+        }
+        out_.flush();
     }
 
-    unlock_table(data_dir, table_name);
-    cout << "Data inserted successfully." << endl;
+private:
+    ostream& out_;  // Поток вывода
+    OutputFormat format_;  // Формат строк
+    string buffer_;  // Накопленные строки
+    CustVector<string> keys_;  // Готовые ключи JSON вида "name":
+    size_t cell_index_;  // Номер ячейки в текущей строке
+};
+
+// Сортировка и ограничение результата SELECT (ORDER BY / LIMIT / OFFSET)
+struct ResultOrder {
+    string column;  // Столбец ORDER BY (пусто - без сортировки)
+    bool descending;  // ORDER BY ... DESC
+    size_t limit;  // LIMIT (NO_ROW - без ограничения)
+    size_t offset;  // OFFSET
+
+    ResultOrder() : descending(false), limit(NO_ROW), offset(0) {}
+};
+
+// Элемент списка SELECT агрегатного запроса
+enum AggregateKind { AGG_GROUP_COLUMN, AGG_COUNT, AGG_SUM, AGG_MIN, AGG_MAX, AGG_AVG };
+
+struct AggregateItem {
+    AggregateKind kind;
+    size_t column;  // Номер столбца (NO_ROW для COUNT(*))
+    string name;  // Заголовок столбца результата
+};
+
+// Накопленное значение одного агрегата в группе
+struct AggregateValue {
+    int64_t count;  // Число учтённых значений
+    int64_t int_sum;  // Сумма для колонки INT
+    double double_sum;  // Сумма для остальных колонок
+    size_t row;  // Строка с минимумом/максимумом (выводится её текст)
+
+    AggregateValue() : count(0), int_sum(0), double_sum(0), row(NO_ROW) {}
+};
+
+// Перемешивание битов ключа группы
+inline uint64_t mix_key_word(uint64_t hash, uint64_t word) {
+    hash ^= word + 0x9E3779B97F4A7C15ULL + (hash << 6) + (hash >> 2);
+    hash ^= hash >> 31;
+    hash *= 0xBF58476D1CE4E5B9ULL;
+    return hash ^ (hash >> 29);
 }
 
+// Хеш-таблица групп (полная или частичная, одного потока). Ключ группы - по слову
+// на столбец группировки: значение INT, биты DOUBLE или код словаря строки.
+// Группы нумеруются в порядке появления, поэтому вывод совпадает с порядком строк
+struct GroupTable {
+    size_t key_width;  // Слов в ключе
+    size_t value_width;  // Агрегатов в группе
+    size_t group_count;  // Число групп
+    CustVector<uint64_t> keys;  // Ключи групп подряд
+    CustVector<size_t> first_rows;  // Первая строка группы (по ней выводятся столбцы группировки)
+    CustVector<AggregateValue> values;  // Агрегаты групп подряд
+    CustVector<size_t> slots;  // Открытая адресация: номер группы + 1, 0 - пусто
+
+    GroupTable(size_t key_words, size_t value_count) : key_width(key_words), value_width(value_count), group_count(0) {}
+
+    // Номер группы с ключом key; новая группа получает строку row как первую
+    size_t find_or_add(const uint64_t* key, size_t row) {
+        if (key_width == 0) {
+            if (group_count == 0) add_group(key, row);
+            return 0;
+        }
+        if ((group_count + 1) * 2 > slots.size) {
+            grow();
+        }
+        size_t mask = slots.size - 1;
+        for (size_t pos = hash_key(key) & mask;; pos = (pos + 1) & mask) {
+            size_t group = slots[pos];
+            if (group == 0) {
+                slots[pos] = group_count + 1;
+                return add_group(key, row);
+            }
+            if (memcmp(&keys[(group - 1) * key_width], key, key_width * sizeof(uint64_t)) == 0) {
+                return group - 1;
+            }
+        }
+    }
 
-// Функция для проверки простого условия
-bool check_simple_condition(const Table* table, size_t row_index, const string& condition) {
-    regex condition_regex(R"((\w+)\s*(=|<|>|<=|>=|!=)\s*('[^']*'|"[^"]*"|\d+))");
-    smatch match;
-    if (!regex_search(condition, match, condition_regex)) {
-        return false;
+    AggregateValue* group_values(size_t group) {
+        return &values[group * value_width];
     }
 
-    string col = match[1];
-    string op = match[2];
-    string val = match[3];
+private:
+    uint64_t hash_key(const uint64_t* key) const {
+        uint64_t hash = 0;
+        for (size_t i = 0; i < key_width; ++i) {
+            hash = mix_key_word(hash, key[i]);
+        }
+        return hash;
+    }
 
-    // Удаление лишних кавычек из значения
-    if (val.front() == '\'' || val.front() == '"') {
-        val = val.substr(1, val.size() - 2);
+    size_t add_group(const uint64_t* key, size_t row) {
+        for (size_t i = 0; i < key_width; ++i) {
+            keys.push_back(key[i]);
+        }
+        first_rows.push_back(row);
+        for (size_t i = 0; i < value_width; ++i) {
+            values.emplace_back();
+        }
+        return group_count++;
     }
 
-    // Ищем столбец и проверяем условие
-    for (size_t j = 0; j < table->columns.size; ++j) {
-        if (table->columns[j] == col) {
-            string cell_value = table->rows[row_index][j];
-            
-            if (op == "=" && cell_value == val) return true;
-            else if (op == "!=" && cell_value != val) return true;
-            else if (op == "<") {
-                try {
-                    double cell_num = stod(cell_value);
-                    double val_num = stod(val);
-                    if (cell_num < val_num) return true;
-                } catch (...) {
-                    if (cell_value < val) return true;
-                }
-            }
-            else if (op == ">") {
-                try {
-                    double cell_num = stod(cell_value);
-                    double val_num = stod(val);
-                    if (cell_num > val_num) return true;
-                } catch (...) {
-                    if (cell_value > val) return true;
-                }
-            }
-            else if (op == "<=") {
-                try {
-                    double cell_num = stod(cell_value);
-                    double val_num = stod(val);
-                    if (cell_num <= val_num) return true;
-                } catch (...) {
-                    if (cell_value <= val) return true;
+    void grow() {
+        size_t capacity = slots.size == 0 ? 64 : slots.size * 2;
+        slots = CustVector<size_t>();
+        slots.reserve(capacity);
+        for (size_t i = 0; i < capacity; ++i) {
+            slots.push_back(0);
+        }
+        size_t mask = capacity - 1;
+        for (size_t group = 0; group < group_count; ++group) {
+            size_t pos = hash_key(&keys[group * key_width]) & mask;
+            while (slots[pos] != 0) pos = (pos + 1) & mask;
+            slots[pos] = group + 1;
+        }
+    }
+};
+
+// Разобранный агрегатный запрос к одной таблице
+struct AggregatePlan {
+    const Table* table;
+    CustVector<AggregateItem> items;  // Столбцы результата
+    CustVector<size_t> group_columns;  // Столбцы группировки
+};
+
+// Сравнение значений столбца в двух строках по типу колонки
+inline bool column_value_less(const Table* table, size_t column, size_t a, size_t b) {
+    const TypedColumn& typed = table->typed_columns[column];
+    if (typed.type == COLUMN_INT) return typed.ints[a] < typed.ints[b];
+    if (typed.type == COLUMN_DOUBLE) return double_less(typed.doubles[a], typed.doubles[b]);
+    return table->rows[a][column] < table->rows[b][column];
+}
+
+// Учёт одной строки в группах
+void accumulate_row(const AggregatePlan& plan, GroupTable& groups, size_t row, uint64_t* key) {
+    const Table* table = plan.table;
+    for (size_t i = 0; i < plan.group_columns.size; ++i) {
+        const TypedColumn& typed = table->typed_columns[plan.group_columns[i]];
+        if (typed.type == COLUMN_INT) {
+            key[i] = static_cast<uint64_t>(typed.ints[row]);
+        } else if (typed.type == COLUMN_DOUBLE) {
+            // 0.0 и -0.0 - одна группа
+            double value = typed.doubles[row] == 0 ? 0.0 : typed.doubles[row];
+            memcpy(&key[i], &value, sizeof(value));
+        } else {
+            key[i] = typed.codes[row];
+        }
+    }
+
+    AggregateValue* values = groups.group_values(groups.find_or_add(key, row));
+    for (size_t i = 0; i < plan.items.size; ++i) {
+        const AggregateItem& item = plan.items[i];
+        AggregateValue& value = values[i];
+        switch (item.kind) {
+            case AGG_GROUP_COLUMN:
+                break;
+            case AGG_COUNT:
+                if (item.column == NO_ROW || !table->rows[row][item.column].empty()) value.count++;
+                break;
+            case AGG_SUM:
+            case AGG_AVG: {
+                const TypedColumn& typed = table->typed_columns[item.column];
+                if (typed.type == COLUMN_INT) {
+                    value.int_sum += typed.ints[row];
+                    value.count++;
+                } else if (typed.type == COLUMN_DOUBLE) {
+                    value.double_sum += typed.doubles[row];
+                    value.count++;
+                } else {
+                    // Нечисловой текст в сумму не входит
+                    double number;
+                    if (parse_number(table->rows[row][item.column], number)) {
+                        value.double_sum += number;
+                        value.count++;
+                    }
                 }
+                break;
             }
-            else if (op == ">=") {
-                try {
-                    double cell_num = stod(cell_value);
-                    double val_num = stod(val);
-                    if (cell_num >= val_num) return true;
-                } catch (...) {
-                    if (cell_value >= val) return true;
+            default: {
+                bool is_min = item.kind == AGG_MIN;
+                if (value.count == 0 || (is_min ? column_value_less(table, item.column, row, value.row)
+                                                : column_value_less(table, item.column, value.row, row))) {
+                    value.row = row;
                 }
+                value.count++;
+                break;
             }
-            break;
         }
     }
-    return false;
 }
 
-// Функция для поиска внешних операторов (игнорируя те, что в скобках)
-size_t find_outer_operator(const string& condition, const string& op) {
-    int bracket_level = 0;
-    size_t pos = 0;
-    
-    while ((pos = condition.find(op, pos)) != string::npos) {
-        // Проверяем что не внутри скобок
-        string before = condition.substr(0, pos);
-        int open_brackets = std::count(before.begin(), before.end(), '(');
-        int close_brackets = std::count(before.begin(), before.end(), ')');
-        
-        if (open_brackets == close_brackets) {
-            return pos; // Нашли внешний оператор
+// Слияние частичных групп потока в общую таблицу. Частичные таблицы сливаются
+// в порядке строк, поэтому первая строка и минимум/максимум совпадают с однопоточными
+void merge_groups(const AggregatePlan& plan, GroupTable& target, GroupTable& partial) {
+    for (size_t group = 0; group < partial.group_count; ++group) {
+        const uint64_t* key = partial.key_width > 0 ? &partial.keys[group * partial.key_width] : nullptr;
+        AggregateValue* into = target.group_values(target.find_or_add(key, partial.first_rows[group]));
+        AggregateValue* from = partial.group_values(group);
+        for (size_t i = 0; i < plan.items.size; ++i) {
+            AggregateKind kind = plan.items[i].kind;
+            if (from[i].count == 0) continue;
+            if (kind == AGG_MIN || kind == AGG_MAX) {
+                size_t column = plan.items[i].column;
+                if (into[i].count == 0 || (kind == AGG_MIN ? column_value_less(plan.table, column, from[i].row, into[i].row)
+                                                           : column_value_less(plan.table, column, into[i].row, from[i].row))) {
+                    into[i].row = from[i].row;
+                }
+            }
+            into[i].count += from[i].count;
+            into[i].int_sum += from[i].int_sum;
+            into[i].double_sum += from[i].double_sum;
         }
-        pos += op.length();
     }
-    return string::npos;
 }
 
-// Рекурсивная функция для проверки сложных условий
-bool check_complex_condition(const Table* table, size_t row_index, const string& condition) {
-    string cond = trim(condition);
-    if (cond.empty()) return true;
-
-    // Ищем самый внешний OR (имеет lowest priority)
-    size_t or_pos = find_outer_operator(cond, " OR ");
-    if (or_pos != string::npos) {
-        string left = trim(cond.substr(0, or_pos));
-        string right = trim(cond.substr(or_pos + 4));
-        return check_complex_condition(table, row_index, left) || 
-               check_complex_condition(table, row_index, right);
+// Хеш-агрегация строк, подходящих под условие. Большая таблица делится между потоками
+// пула на непрерывные диапазоны кусков; каждый поток копит свои частичные группы
+void aggregate_matching_rows(const AggregatePlan& plan, const Condition* cond, GroupTable& groups) {
+    const Table* table = plan.table;
+    CustVector<uint64_t> key;
+    for (size_t i = 0; i < plan.group_columns.size; ++i) key.push_back(0);
+
+    CustVector<size_t> candidates;
+    if (plan_index_lookup(table, cond, candidates)) {
+        for (size_t i = 0; i < candidates.size; ++i) {
+            if (!row_deleted(table, candidates[i]) && eval_condition(cond, table, candidates[i])) {
+                accumulate_row(plan, groups, candidates[i], key.data);
+            }
+        }
+        profile_rows(STAGE_AGGREGATE, candidates.size, groups.group_count);
+        return;
     }
 
-    // Ищем самый внешний AND (приоритет выше чем OR)
-    size_t and_pos = find_outer_operator(cond, " AND ");
-    if (and_pos != string::npos) {
-        string left = trim(cond.substr(0, and_pos));
-        string right = trim(cond.substr(and_pos + 5));
-        return check_complex_condition(table, row_index, left) && 
-               check_complex_condition(table, row_index, right);
+    size_t row_count = table->rows.size;
+    size_t chunk_count = (row_count + SCAN_CHUNK_ROWS - 1) / SCAN_CHUNK_ROWS;
+    size_t task_count = min(chunk_count, scan_pool().thread_count());
+    if (row_count < PARALLEL_SCAN_MIN_ROWS || task_count <= 1) {
+        CustVector<size_t> matched;
+        for (size_t begin = 0; begin < row_count; begin += SCAN_CHUNK_ROWS) {
+            matched.clear();
+            filter_rows(table, cond, begin, min(row_count, begin + SCAN_CHUNK_ROWS), matched);
+            for (size_t m = 0; m < matched.size; ++m) {
+                accumulate_row(plan, groups, matched[m], key.data);
+            }
+        }
+        profile_rows(STAGE_AGGREGATE, row_count, groups.group_count);
+        return;
     }
 
-    // Если есть скобки - обрабатываем вложенное выражение
-    if (cond.front() == '(' && cond.back() == ')') {
-        string inner_cond = cond.substr(1, cond.size() - 2);
-        return check_complex_condition(table, row_index, inner_cond);
+    CustVector<GroupTable> partials;
+    partials.reserve(task_count);
+    for (size_t t = 0; t < task_count; ++t) {
+        partials.emplace_back(groups.key_width, groups.value_width);
     }
-
-    // Простое условие без операторов
-    return check_simple_condition(table, row_index, cond);
+    size_t chunks_per_task = (chunk_count + task_count - 1) / task_count;
+    scan_pool().run(task_count, [&](size_t t) {
+        CustVector<uint64_t> task_key;
+        for (size_t i = 0; i < plan.group_columns.size; ++i) task_key.push_back(0);
+        CustVector<size_t> matched;
+        size_t last_chunk = min(chunk_count, (t + 1) * chunks_per_task);
+        for (size_t c = t * chunks_per_task; c < last_chunk; ++c) {
+            matched.clear();
+            filter_rows(table, cond, c * SCAN_CHUNK_ROWS, min(row_count, (c + 1) * SCAN_CHUNK_ROWS), matched);
+            for (size_t m = 0; m < matched.size; ++m) {
+                accumulate_row(plan, partials[t], matched[m], task_key.data);
+            }
+        }
+    });
+    for (size_t t = 0; t < task_count; ++t) {
+        merge_groups(plan, groups, partials[t]);
+    }
+    profile_rows(STAGE_AGGREGATE, row_count, groups.group_count);
 }
 
-void delete_data(const string& data_dir, const string& table_name, const string& condition) {
-    wait_for_unlock(data_dir, table_name);
-
-    Table* table = reinterpret_cast<Table*>(tables.get(table_name));
-    if (!table) {
-        unlock_table(data_dir, table_name);
-        cout << "Table not found." << endl;
-        return;
+// Текст числа с плавающей точкой: кратчайшая из записей %.15g и %.17g, читаемая обратно без потерь
+string format_double(double value) {
+    char text[32];
+    snprintf(text, sizeof(text), "%.15g", value);
+    if (strtod(text, nullptr) != value) {
+        snprintf(text, sizeof(text), "%.17g", value);
     }
+    return text;
+}
 
-    if (table->rows.size == 0) {
-        unlock_table(data_dir, table_name);
-        cout << "Table is empty. Nothing to delete." << endl;
-        return;
+// Агрегатный SELECT: COUNT/SUM/MIN/MAX/AVG, при необходимости с GROUP BY
+void aggregate_data(const Table* table, const CustVector<string>& columns, const CustVector<string>& group_by, const string& condition,
+                    const ResultOrder& order) {
+    AggregatePlan plan;
+    plan.table = table;
+    for (size_t i = 0; i < group_by.size; ++i) {
+        size_t column = find_table_column(table, group_by[i]);
+        if (column == NO_ROW) {
+            cout << "Error: GROUP BY column '" << group_by[i] << "' not found in table '" << table->name << "'" << endl;
+            return;
+        }
+        plan.group_columns.push_back(column);
     }
 
-    CustVector<CustVector<string>> new_rows;
-    bool any_match = false;
-    size_t old_rows_size = table->rows.size;
+    for (size_t i = 0; i < columns.size; ++i) {
+        const string& text = columns[i];
+        AggregateItem item;
+        size_t open = text.find('(');
+        if (open == string::npos || text.back() != ')') {
+            item.kind = AGG_GROUP_COLUMN;
+            item.column = find_table_column(table, text);
+            item.name = text;
+            bool grouped = false;
+            for (size_t k = 0; k < plan.group_columns.size; ++k) {
+                grouped = grouped || plan.group_columns[k] == item.column;
+            }
+            if (item.column == NO_ROW || !grouped) {
+                cout << "Error: Column '" << text << "' must appear in GROUP BY or be used in an aggregate function" << endl;
+                return;
+            }
+            plan.items.push_back(item);
+            continue;
+        }
 
-    for (size_t i = 0; i < table->rows.size; ++i) {
-        if (check_complex_condition(table, i, condition)) {
-            any_match = true;
+        string function = text.substr(0, open);
+        transform(function.begin(), function.end(), function.begin(), ::toupper);
+        string argument = trim(text.substr(open + 1, text.size() - open - 2));
+        if (function == "COUNT") item.kind = AGG_COUNT;
+        else if (function == "SUM") item.kind = AGG_SUM;
+        else if (function == "MIN") item.kind = AGG_MIN;
+        else if (function == "MAX") item.kind = AGG_MAX;
+        else if (function == "AVG") item.kind = AGG_AVG;
+        else {
+            cout << "Error: Unknown aggregate function '" << function << "'" << endl;
+            return;
+        }
+        if (item.kind == AGG_COUNT && argument == "*") {
+            item.column = NO_ROW;
         } else {
-            new_rows.push_back(table->rows[i]);
+            item.column = find_table_column(table, argument);
+            if (item.column == NO_ROW) {
+                cout << "Error: Column '" << argument << "' not found in table '" << table->name << "'" << endl;
+                return;
+            }
         }
+        // Имя таблицы в заголовке опускается, иначе формат вывода отрежет всё до точки
+        item.name = function + "(" + (item.column == NO_ROW ? string("*") : table->columns[item.column]) + ")";
+        plan.items.push_back(item);
     }
 
-    if (!any_match) {
-        unlock_table(data_dir, table_name);
-        cout << "No rows matched the condition. Nothing to delete." << endl;
-        return;
+    // ORDER BY ссылается на столбец результата: по тексту, заголовку или столбцу группировки
+    size_t order_item = NO_ROW;
+    if (!order.column.empty()) {
+        size_t order_column = find_table_column(table, order.column);
+        for (size_t i = 0; i < plan.items.size && order_item == NO_ROW; ++i) {
+            const AggregateItem& item = plan.items[i];
+            if (columns[i] == order.column || item.name == order.column ||
+                (item.kind == AGG_GROUP_COLUMN && item.column == order_column)) {
+                order_item = i;
+            }
+        }
+        if (order_item == NO_ROW) {
+            cout << "Error: ORDER BY column '" << order.column << "' must be one of the selected columns" << endl;
+            return;
+        }
     }
 
-    // Находим индекс первичного ключа
-    size_t pk_index = 0;
-    for (size_t i = 0; i < table->columns.size; ++i) {
-        if (table->columns[i] == table->primary_key) {
-            pk_index = i;
-            break;
+    GroupTable groups(plan.group_columns.size, plan.items.size);
+    {
+        ProfileScope profile(STAGE_AGGREGATE);
+        Condition* compiled = compile_condition(table, condition);
+        aggregate_matching_rows(plan, compiled, groups);
+        delete compiled;
+        // Без GROUP BY результат - одна строка даже для пустой выборки
+        if (plan.group_columns.size == 0) {
+            groups.find_or_add(nullptr, NO_ROW);
         }
     }
 
-    // Пересчитываем значения первичного ключа
-    for (size_t i = 0; i < new_rows.size; ++i) {
-        new_rows[i][pk_index] = to_string(i + 1);
+    ResultSink sink(cout, output_format);
+    CustVector<string> header;
+    for (size_t i = 0; i < plan.items.size; ++i) {
+        header.push_back(plan.items[i].name);
     }
+    sink.header(header);
 
-    table->rows = new_rows;
+    // Порядок групп: порядок появления или ORDER BY (устойчивая сортировка)
+    CustVector<size_t> group_order;
+    group_order.reserve(groups.group_count);
+    for (size_t group = 0; group < groups.group_count; ++group) {
+        group_order.push_back(group);
+    }
+    if (order_item != NO_ROW) {
+        const AggregateItem& item = plan.items[order_item];
+        bool int_column = item.column != NO_ROW && table->typed_columns[item.column].type == COLUMN_INT;
+        auto number_of = [&item, int_column](const AggregateValue& value) {
+            if (item.kind == AGG_COUNT) return static_cast<double>(value.count);
+            double sum = int_column ? static_cast<double>(value.int_sum) : value.double_sum;
+            return item.kind == AGG_AVG ? sum / value.count : sum;
+        };
+        // NULL (агрегат без значений) считается меньше любого значения
+        auto group_less = [&](size_t a, size_t b) {
+            const AggregateValue& x = groups.group_values(a)[order_item];
+            const AggregateValue& y = groups.group_values(b)[order_item];
+            if (item.kind == AGG_GROUP_COLUMN) {
+                return column_value_less(table, item.column, groups.first_rows[a], groups.first_rows[b]);
+            }
+            if (item.kind != AGG_COUNT && (x.count == 0 || y.count == 0)) {
+                return x.count == 0 && y.count != 0;
+            }
+            if (item.kind == AGG_MIN || item.kind == AGG_MAX) {
+                return column_value_less(table, item.column, x.row, y.row);
+            }
+            return double_less(number_of(x), number_of(y));
+        };
+        stable_sort(group_order.data, group_order.data + group_order.size, [&](size_t a, size_t b) {
+            return order.descending ? group_less(b, a) : group_less(a, b);
+        });
+    }
+    size_t first = min(order.offset, groups.group_count);
+    size_t last = order.limit == NO_ROW ? groups.group_count : min(groups.group_count, first + order.limit);
+
+    ProfileScope output_profile(STAGE_OUTPUT);
+    profile_rows(STAGE_OUTPUT, groups.group_count, last - first);
+    for (size_t position = first; position < last; ++position) {
+        size_t group = group_order[position];
+        const AggregateValue* values = groups.group_values(group);
+        sink.begin_row();
+        for (size_t i = 0; i < plan.items.size; ++i) {
+            const AggregateItem& item = plan.items[i];
+            const AggregateValue& value = values[i];
+            bool int_column = item.column != NO_ROW && table->typed_columns[item.column].type == COLUMN_INT;
+            switch (item.kind) {
+                case AGG_GROUP_COLUMN:
+                    sink.cell(table->rows[groups.first_rows[group]][item.column]);
+                    break;
+                case AGG_COUNT:
+                    sink.cell(to_string(value.count));
+                    break;
+                case AGG_SUM:
+                    if (value.count == 0) sink.null_cell();
+                    else sink.cell(int_column ? to_string(value.int_sum) : format_double(value.double_sum));
+                    break;
+                case AGG_AVG:
+                    if (value.count == 0) sink.null_cell();
+                    else sink.cell(format_double((int_column ? static_cast<double>(value.int_sum) : value.double_sum) / value.count));
+                    break;
+                default:
+                    if (value.count == 0) sink.null_cell();
+                    else sink.cell(table->rows[value.row][item.column]);
+                    break;
+            }
+        }
+        sink.end_row();
+    }
+}
 
-    // Обновление последовательности первичных ключей
-    write_pk_sequence(data_dir, table_name, new_rows.size);
+// Порядок строк ORDER BY: по значению столбца, при равенстве - по номеру строки,
+// поэтому результат совпадает с устойчивой сортировкой
+struct RowOrder {
+    const Table* table;
+    size_t column;
+    bool descending;
+
+    bool operator()(size_t a, size_t b) const {
+        if (column_value_less(table, column, a, b)) return !descending;
+        if (column_value_less(table, column, b, a)) return descending;
+        return a < b;
+    }
+};
 
-    // Сохраняем в файл
-    if (table->file_format == "json") {
-        save_table_json(data_dir, *table);
-    } else if (table->file_format == "csv") {
-        save_table_csv(data_dir, *table);
-    } else {
-        save_table_json(data_dir, *table);
+// Выборка строк одной таблицы с учётом ORDER BY и LIMIT. emit получает номера строк
+// в порядке вывода. LIMIT без ORDER BY останавливает просмотр, как только набрано
+// достаточно строк; ORDER BY с LIMIT держит кучу из OFFSET + LIMIT лучших строк;
+// ORDER BY без LIMIT сортирует номера подходящих строк в памяти: таблица уже целиком
+// в памяти, и сортировка добавляет к ней лишь массив номеров
+void select_ordered_rows(const Table* table, const Condition* cond, const ResultOrder& order,
+                         size_t order_column, const function<void(size_t)>& emit) {
+    size_t wanted = order.limit == NO_ROW ? NO_ROW : order.offset + order.limit;
+    if (wanted == 0) {
+        return;
+    }
+    size_t skipped = 0;
+    size_t emitted = 0;
+    // Вывод с учётом OFFSET и LIMIT; false - больше строк не нужно
+    auto take = [&](size_t row) {
+        if (skipped < order.offset) {
+            ++skipped;
+            return true;
+        }
+        emit(row);
+        return ++emitted < order.limit;
+    };
+
+    if (order_column == NO_ROW) {
+        for_each_matching_chunk(table, cond, [&](const CustVector<size_t>& rows) {
+            for (size_t i = 0; i < rows.size; ++i) {
+                if (!take(rows[i])) return false;
+            }
+            return true;
+        });
+        return;
     }
 
-    unlock_table(data_dir, table_name);
-    cout << "Successfully deleted " << (old_rows_size - new_rows.size)
-         << " rows from table '" << table_name << "'" << endl;
+    RowOrder row_order{table, order_column, order.descending};
+    if (wanted != NO_ROW) {
+        // Вершина кучи - худшая из отобранных строк
+        CustVector<size_t> heap;
+        for_each_matching_chunk(table, cond, [&](const CustVector<size_t>& rows) {
+            for (size_t i = 0; i < rows.size; ++i) {
+                if (heap.size < wanted) {
+                    heap.push_back(rows[i]);
+                    push_heap(heap.data, heap.data + heap.size, row_order);
+                } else if (row_order(rows[i], heap[0])) {
+                    pop_heap(heap.data, heap.data + heap.size, row_order);
+                    heap[heap.size - 1] = rows[i];
+                    push_heap(heap.data, heap.data + heap.size, row_order);
+                }
+            }
+            return true;
+        });
+        sort_heap(heap.data, heap.data + heap.size, row_order);
+        for (size_t i = 0; i < heap.size && take(heap[i]); ++i) {
+        }
+        return;
+    }
+
+    CustVector<size_t> matched;
+    for_each_matching_chunk(table, cond, [&](const CustVector<size_t>& rows) {
+        for (size_t i = 0; i < rows.size; ++i) {
+            matched.push_back(rows[i]);
+        }
+        return true;
+    });
+    sort(matched.data, matched.data + matched.size, row_order);
+    for (size_t i = 0; i < matched.size && take(matched[i]); ++i) {
+    }
 }
 
-void select_data(const string& data_dir, const CustVector<string>& table_names, const CustVector<string>& columns, const string& condition = "") {
+void select_data(const string& data_dir, const CustVector<string>& table_names, const CustVector<string>& columns, const string& condition = "",
+                 const CustVector<string>& group_by = CustVector<string>(), const ResultOrder& order = ResultOrder()) {
     // Проверка на количество таблиц
     if (table_names.size == 0) {
         cout << "No tables specified." << endl;
@@ -801,16 +4825,30 @@ void select_data(const string& data_dir, const CustVector<string>& table_names,
     // Загружаем таблицы
     CustVector<const Table*> loaded_tables;
     for (size_t i = 0; i < table_names.size; ++i) {
-        Table* table = reinterpret_cast<Table*>(tables.get(table_names[i]));
+        Table* table = tables.get(table_names[i]);
         if (!table) {
             load_table(data_dir, table_names[i]);
-            table = reinterpret_cast<Table*>(tables.get(table_names[i]));
+            table = tables.get(table_names[i]);
             if (!table) {
                 cout << "Table not found: " << table_names[i] << endl;
                 return;
             }
         }
-        loaded_tables.push_back(table);
+        loaded_tables.push_back(table);
+    }
+
+    // Агрегатные функции и GROUP BY считаются хеш-агрегацией по одной таблице
+    bool aggregate = group_by.size > 0;
+    for (size_t i = 0; i < columns.size; ++i) {
+        aggregate = aggregate || (columns[i].find('(') != string::npos && columns[i].back() == ')');
+    }
+    if (aggregate) {
+        if (table_names.size != 1) {
+            cout << "Error: Aggregate functions and GROUP BY are supported for 1 table only." << endl;
+            return;
+        }
+        aggregate_data(loaded_tables[0], columns, group_by, condition, order);
+        return;
     }
 
     // Определяем колонки для вывода
@@ -838,6 +4876,10 @@ void select_data(const string& data_dir, const CustVector<string>& table_names,
             cout << "Error: Condition is required for 2 tables." << endl;
             return;
         }
+        if (!order.column.empty()) {
+            cout << "Error: ORDER BY is supported for 1 table only." << endl;
+            return;
+        }
 
         // Проверяем формат условия
         size_t equal_pos = condition.find('=');
@@ -894,89 +4936,106 @@ void select_data(const string& data_dir, const CustVector<string>& table_names,
         }
 
         // Выводим заголовки
-        for (size_t i = 0; i < selected_columns.size; ++i) {
-            size_t dot_pos = selected_columns[i].find(".");
-            string column_name_part = (dot_pos != string::npos) ? selected_columns[i].substr(dot_pos + 1) : selected_columns[i];
-            cout << column_name_part << "\t";
-        }
-        cout << endl;
-        cout << string(selected_columns.size * 10, '-') << endl;
-
-        // Ищем совпадающие строки
-        for (size_t i = 0; i < loaded_tables[0]->rows.size; ++i) {
-            for (size_t j = 0; j < loaded_tables[1]->rows.size; ++j) {
-                if (loaded_tables[0]->rows[i][left_col_index] == loaded_tables[1]->rows[j][right_col_index]) {
-                    // Выводим данные из первой таблицы
-                    for (size_t col_idx = 0; col_idx < selected_columns.size; ++col_idx) {
-                        string full_col_name = selected_columns[col_idx];
-                        size_t dot_pos = full_col_name.find(".");
-                        string table_name_part = full_col_name.substr(0, dot_pos);
-                        string column_name_part = full_col_name.substr(dot_pos + 1);
-                        if (table_name_part == loaded_tables[0]->name) {
-                            for (size_t k = 0; k < loaded_tables[0]->columns.size; ++k) {
-                                if (loaded_tables[0]->columns[k] == column_name_part) {
-                                    cout << loaded_tables[0]->rows[i][k] << "\t";
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    // Выводим данные из второй таблицы
-                    for (size_t col_idx = 0; col_idx < selected_columns.size; ++col_idx) {
-                        string full_col_name = selected_columns[col_idx];
-                        size_t dot_pos = full_col_name.find(".");
-                        string table_name_part = full_col_name.substr(0, dot_pos);
-                        string column_name_part = full_col_name.substr(dot_pos + 1);
-                        if (table_name_part == loaded_tables[1]->name) {
-                            for (size_t k = 0; k < loaded_tables[1]->columns.size; ++k) {
-                                if (loaded_tables[1]->columns[k] == column_name_part) {
-                                    cout << loaded_tables[1]->rows[j][k] << "\t";
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                    cout << endl;
+        ResultSink sink(cout, output_format);
+        sink.header(selected_columns);
+
+        // Индексы выводимых колонок вычисляем один раз до цикла соединения
+        CustVector<size_t> left_output;
+        CustVector<size_t> right_output;
+        resolve_join_output(loaded_tables[0], selected_columns, left_output);
+        resolve_join_output(loaded_tables[1], selected_columns, right_output);
+
+        // Левую таблицу просматриваем по порядку строк, хеш-таблицу строим по правой
+        // (или берём её хеш-индекс): цепочки идут по возрастанию номеров строк, поэтому
+        // результат упорядочен по (левая строка, правая строка), как у вложенных циклов,
+        // и LIMIT/OFFSET не зависят от размеров таблиц
+        const Table* left = loaded_tables[0];
+        const Table* right = loaded_tables[1];
+        ProfileScope join_profile(STAGE_JOIN);
+        size_t joined_rows = 0;
+        HashIndex built_index;
+        const HashIndex* index = find_hash_index(right, right_col_index);
+        if (!index) {
+            built_index.build(right, right_col_index);
+            index = &built_index;
+        }
+
+        // LIMIT останавливает соединение, как только набрано OFFSET + LIMIT строк
+        size_t join_end = order.limit == NO_ROW ? NO_ROW : order.offset + order.limit;
+        for (size_t l = 0; l < left->rows.size && joined_rows < join_end; ++l) {
+            if (row_deleted(left, l)) continue;
+            const CustVector<string>& left_row = left->rows[l];
+            const string& key = left_row[left_col_index];
+            for (size_t r = index->find(key); r != NO_ROW && joined_rows < join_end; r = index->next_match(r, key)) {
+                if (row_deleted(right, r)) continue;
+                if (joined_rows++ < order.offset) continue;
+                const CustVector<string>& right_row = right->rows[r];
+                sink.begin_row();
+                for (size_t k = 0; k < left_output.size; ++k) {
+                    sink.cell(left_row[left_output[k]]);
                 }
+                for (size_t k = 0; k < right_output.size; ++k) {
+                    sink.cell(right_row[right_output[k]]);
+                }
+                sink.end_row();
             }
         }
+        profile_rows(STAGE_JOIN, left->rows.size + right->rows.size, joined_rows);
     } else {
         // Если одна таблица
         const Table* table = loaded_tables[0];
+        size_t order_column = NO_ROW;
+        if (!order.column.empty()) {
+            order_column = find_table_column(table, order.column);
+            if (order_column == NO_ROW) {
+                cout << "Error: ORDER BY column '" << order.column << "' not found in table '" << table->name << "'" << endl;
+                return;
+            }
+        }
 
         // Выводим заголовки
-        for (size_t i = 0; i < selected_columns.size; ++i) {
-            size_t dot_pos = selected_columns[i].find(".");
-            string column_name_part = (dot_pos != string::npos) ? selected_columns[i].substr(dot_pos + 1) : selected_columns[i];
-            cout << column_name_part << "\t";
+        ResultSink sink(cout, output_format);
+        sink.header(selected_columns);
+
+        // Номера выводимых колонок (NO_ROW - колонки нет) вычисляем один раз
+        CustVector<size_t> output;
+        for (size_t j = 0; j < selected_columns.size; ++j) {
+            output.push_back(find_table_column(table, selected_columns[j]));
         }
-        cout << endl;
-        cout << string(selected_columns.size * 10, '-') << endl;
 
-        // Проходим по строкам таблицы и проверяем условие
-        bool has_condition = !condition.empty();
-        for (size_t i = 0; i < table->rows.size; ++i) {
-            if (!has_condition || check_complex_condition(table, i, condition)) {
-                for (size_t j = 0; j < selected_columns.size; ++j) {
-                    string column_name_part = selected_columns[j];
-                    size_t dot_pos = column_name_part.find(".");
-                    if (dot_pos != string::npos) {
-                        column_name_part = column_name_part.substr(dot_pos + 1);
-                    }
-                    bool value_found = false;
-                    for (size_t k = 0; k < table->columns.size; ++k) {
-                        if (table->columns[k] == column_name_part) {
-                            cout << table->rows[i][k] << "\t";
-                            value_found = true;
-                            break;
-                        }
-                    }
-                    if (!value_found) {
-                        cout << "NULL\t";
-                    }
+        auto emit_row = [&](size_t row_index) {
+            const CustVector<string>& row = table->rows[row_index];
+            sink.begin_row();
+            for (size_t j = 0; j < output.size; ++j) {
+                if (output[j] == NO_ROW) {
+                    sink.null_cell();
+                } else {
+                    sink.cell(row[output[j]]);
                 }
-                cout << endl;
             }
+            sink.end_row();
+        };
+
+        // Проходим по строкам таблицы и проверяем условие
+        Condition* compiled = compile_condition(table, condition);
+        if (!order.column.empty() || order.limit != NO_ROW) {
+            size_t emitted = 0;
+            select_ordered_rows(table, compiled, order, order_column, [&](size_t row_index) {
+                emit_row(row_index);
+                ++emitted;
+            });
+            delete compiled;
+            profile_rows(STAGE_OUTPUT, emitted, emitted);
+            return;
+        }
+        CustVector<size_t> matched;
+        find_matching_rows(table, compiled, matched);
+        delete compiled;
+
+        ProfileScope output_profile(STAGE_OUTPUT);
+        profile_rows(STAGE_OUTPUT, matched.size, matched.size);
+        for (size_t m = 0; m < matched.size; ++m) {
+            emit_row(matched[m]);
         }
     }
 }
@@ -997,6 +5056,10 @@ CustVector<string> parse_command(const string& command) {
         if (token.front() == '(' && token.back() == ')') {
             tokens.push_back(token.substr(1, token.size() - 2));
         }
+        else if (!inside_quotes && token.find('(') != string::npos && token.back() == ')') {
+            // Вызов вида table(column) остаётся одним токеном
+            tokens.push_back(token);
+        }
         else if (token.front() == '(') {
             inside_quotes = true;
             current_token += token.substr(1) + " ";
@@ -1022,25 +5085,81 @@ CustVector<string> parse_command(const string& command) {
     return tokens;
 }
 
-int main(int argc, char* argv[]) {
-    // Проверка формата команды
-    if (argc != 5 || string(argv[1]) != "--file" || string(argv[3]) != "--query") {
-        cerr << "Usage: " << argv[0] << " --file <data_directory> --query '<SQL_command>'" << endl;
-        return 1;
+// Неотрицательное число строк из LIMIT/OFFSET
+bool parse_row_count(const string& text, size_t& value) {
+    if (text.empty() || text.size() > 18 || !all_of(text.begin(), text.end(), ::isdigit)) {
+        return false;
     }
+    value = stoull(text);
+    return true;
+}
 
-    // Получаем директорию с данными
-    string data_dir = argv[2];
-    
-    // Проверяем существование директории
-    if (!fs::exists(data_dir) || !fs::is_directory(data_dir)) {
-        cerr << "Error: Directory not found: " << data_dir << endl;
-        return 1;
+// Разбор списка кортежей VALUES (v1, v2), (v3, v4). Значения в кавычках могут
+// содержать запятые и скобки. Возвращает false, если текст не является таким
+// списком - тогда значения разбираются старым способом, по токенам
+bool parse_value_tuples(const string& text, CustVector<CustVector<string>>& rows) {
+    size_t pos = 0;
+    bool has_comma = false;
+    auto skip_spaces = [&]() {
+        while (pos < text.size() && isspace(static_cast<unsigned char>(text[pos]))) ++pos;
+    };
+    skip_spaces();
+    if (pos >= text.size()) {
+        return false;
+    }
+    while (pos < text.size()) {
+        if (text[pos] != '(') {
+            return false;
+        }
+        ++pos;
+        CustVector<string>& values = rows.emplace_back();
+        string value;
+        char quote = 0;
+        bool closed = false;
+        for (; pos < text.size(); ++pos) {
+            char c = text[pos];
+            if (quote) {
+                if (c == quote) quote = 0;
+                else value += c;
+            } else if (c == '\'' || c == '"') {
+                quote = c;
+            } else if (c == ',') {
+                values.push_back(trim(value));
+                value.clear();
+                has_comma = true;
+            } else if (c == ')') {
+                values.push_back(trim(value));
+                closed = true;
+                ++pos;
+                break;
+            } else {
+                value += c;
+            }
+        }
+        if (!closed) {
+            return false;
+        }
+        skip_spaces();
+        if (pos < text.size() && text[pos] == ',') {
+            has_comma = true;
+            ++pos;
+            skip_spaces();
+        }
     }
+    // Без запятых это старая форма VALUES (v1) (v2) - по значению в скобках
+    return has_comma;
+}
 
+// Выполнение одного запроса. Возвращает код завершения (0 - успех)
+int run_query(const string& data_dir, const string& query) {
+    // Таблицы, к которым обращается этот запрос, не вытесняются из кэша до его конца
+    table_cache.query_id++;
     // Разбираем query часть
-    string query(argv[4]);
-    CustVector<string> tokens = parse_command(query);
+    CustVector<string> tokens;
+    {
+        ProfileScope profile(STAGE_PARSE);
+        tokens = parse_command(query);
+    }
     
     if (tokens.size == 0) {
         cerr << "Error: Empty query" << endl;
@@ -1052,7 +5171,7 @@ int main(int argc, char* argv[]) {
     try {
     if (command == "SELECT") {
     if (tokens.size < 4) {
-        cerr << "Invalid SELECT command. Usage: SELECT column1,column2 FROM table_name1,table_name2 [WHERE condition]" << endl;
+        cerr << "Invalid SELECT command. Usage: SELECT column1,column2 FROM table_name1,table_name2 [WHERE condition] [GROUP BY column1,column2] [ORDER BY column [ASC|DESC]] [LIMIT n [OFFSET m]]" << endl;
         return 1;
     }
 
@@ -1120,10 +5239,31 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Получаем имена таблиц (между FROM и WHERE или концом)
+    // Ищем GROUP BY (если есть)
+    size_t group_pos = tokens.size;
+    for (size_t i = from_pos + 1; i + 1 < tokens.size; ++i) {
+        if (tokens[i] == "GROUP" && tokens[i + 1] == "BY") {
+            group_pos = i;
+            break;
+        }
+    }
+
+    // Ищем ORDER BY и LIMIT (если есть)
+    size_t order_pos = tokens.size;
+    size_t limit_pos = tokens.size;
+    for (size_t i = from_pos + 1; i < tokens.size; ++i) {
+        if (order_pos == tokens.size && tokens[i] == "ORDER" && i + 1 < tokens.size && tokens[i + 1] == "BY") {
+            order_pos = i;
+        } else if (limit_pos == tokens.size && tokens[i] == "LIMIT") {
+            limit_pos = i;
+        }
+    }
+    size_t tail_pos = min(order_pos, limit_pos);  // Начало ORDER BY / LIMIT
+
+    // Получаем имена таблиц (между FROM и WHERE/GROUP BY/ORDER BY/LIMIT или концом)
     CustVector<string> table_names;
     size_t table_start = from_pos + 1;
-    size_t table_end = (where_pos < tokens.size) ? where_pos : tokens.size;
+    size_t table_end = min(min(where_pos, group_pos), tail_pos);
     for (size_t i = table_start; i < table_end; ++i) {
         string table_str = tokens[i];
         if (table_str.find(',') != string::npos) {
@@ -1151,8 +5291,9 @@ int main(int argc, char* argv[]) {
 
     // Получаем условие WHERE (если есть)
     string condition = "";
-    if (where_pos < tokens.size - 1) {
-        for (size_t i = where_pos + 1; i < tokens.size; ++i) {
+    size_t condition_end = min(group_pos, tail_pos);
+    if (where_pos + 1 < condition_end) {
+        for (size_t i = where_pos + 1; i < condition_end; ++i) {
             if (i > where_pos + 1) condition += " ";
             condition += tokens[i];
         }
@@ -1162,28 +5303,113 @@ int main(int argc, char* argv[]) {
         }
     }
 
-    // Загружаем все указанные таблицы и проверяем успешность загрузки
-    for (size_t i = 0; i < table_names.size; ++i) {
-        load_table(data_dir, table_names[i]);
-        Table* table = reinterpret_cast<Table*>(tables.get(table_names[i]));
-        if (!table) {
+    // Получаем столбцы GROUP BY
+    CustVector<string> group_by;
+    for (size_t i = group_pos + 2; i < tail_pos; ++i) {
+        istringstream iss_group(tokens[i]);
+        string column;
+        while (getline(iss_group, column, ',')) {
+            string trimmed_column = trim(column);
+            if (!trimmed_column.empty()) {
+                group_by.push_back(trimmed_column);
+            }
+        }
+    }
+    if (group_pos < tokens.size && group_by.size == 0) {
+        cerr << "Error: No columns specified after GROUP BY" << endl;
+        return 1;
+    }
+
+    // Получаем ORDER BY column [ASC|DESC] и LIMIT n [OFFSET m]
+    ResultOrder order;
+    if (order_pos < tokens.size) {
+        size_t order_end = limit_pos > order_pos ? limit_pos : tokens.size;
+        if (order_pos + 2 >= order_end || order_pos + 4 < order_end ||
+            (order_pos + 3 < order_end && tokens[order_pos + 3] != "ASC" && tokens[order_pos + 3] != "DESC")) {
+            cerr << "Invalid ORDER BY clause. Usage: ORDER BY column [ASC|DESC]" << endl;
+            return 1;
+        }
+        order.column = tokens[order_pos + 2];
+        order.descending = order_pos + 3 < order_end && tokens[order_pos + 3] == "DESC";
+    }
+    if (limit_pos < tokens.size) {
+        size_t limit_end = order_pos > limit_pos ? order_pos : tokens.size;
+        bool valid = limit_pos + 2 == limit_end || (limit_pos + 4 == limit_end && tokens[limit_pos + 2] == "OFFSET");
+        if (valid) {
+            valid = parse_row_count(tokens[limit_pos + 1], order.limit) &&
+                    (limit_pos + 4 != limit_end || parse_row_count(tokens[limit_pos + 3], order.offset));
+        }
+        if (!valid) {
+            cerr << "Invalid LIMIT clause. Usage: LIMIT n [OFFSET m]" << endl;
             return 1;
         }
     }
 
-    select_data(data_dir, table_names, columns, condition);
+    // Разделяемые блокировки: читатели не мешают друг другу, но ждут писателей.
+    // Берём их в порядке имён, чтобы порядок захвата был одинаковым у всех
+    CustVector<string> lock_order = table_names;
+    sort(lock_order.data, lock_order.data + lock_order.size);
+    CustVector<int> lock_fds;
+    for (size_t i = 0; i < lock_order.size; ++i) {
+        lock_fds.push_back(wait_for_unlock(data_dir, lock_order[i], SHARED_LOCK));
+    }
+
+    // Столбцы, упомянутые запросом: загрузчик разбирает только их. Слова из условия
+    // берутся целиком, лишние (литералы, имена таблиц) просто не совпадут ни с одним столбцом
+    CustVector<string> needed;
+    bool all_columns = false;
+    string mentioned = condition + " " + order.column;
+    for (size_t i = 0; i < columns.size; ++i) {
+        all_columns = all_columns || (!columns[i].empty() && columns[i].back() == '*' && columns[i].find('(') == string::npos);
+        mentioned += " " + columns[i];
+    }
+    for (size_t i = 0; i < group_by.size; ++i) {
+        mentioned += " " + group_by[i];
+    }
+    size_t word_start = NO_ROW;
+    for (size_t i = 0; i <= mentioned.size(); ++i) {
+        bool word_char = i < mentioned.size() && !strchr(" ,()=<>!'\"*.\t", mentioned[i]);
+        if (word_char && word_start == NO_ROW) {
+            word_start = i;
+        } else if (!word_char && word_start != NO_ROW) {
+            needed.emplace_back(mentioned, word_start, i - word_start);
+            word_start = NO_ROW;
+        }
+    }
+
+    // Загружаем все указанные таблицы и проверяем успешность загрузки.
+    // Блокировки снимаются и тогда, когда файл таблицы не разбирается
+    bool all_loaded = true;
+    try {
+        for (size_t i = 0; i < table_names.size && all_loaded; ++i) {
+            all_loaded = find_or_load_table(data_dir, table_names[i], all_columns ? nullptr : &needed) != nullptr;
+        }
+
+        if (all_loaded) {
+            select_data(data_dir, table_names, columns, condition, group_by, order);
+        }
+    } catch (...) {
+        for (size_t i = 0; i < lock_fds.size; ++i) {
+            unlock_table(lock_fds[i]);
+        }
+        throw;
+    }
+    for (size_t i = 0; i < lock_fds.size; ++i) {
+        unlock_table(lock_fds[i]);
+    }
+    if (!all_loaded) {
+        return 1;
+    }
 }
     else if (command == "INSERT") {
     if (tokens.size < 4 || tokens[1] != "INTO" || tokens[3] != "VALUES") {
-        cerr << "Invalid INSERT command. Usage: INSERT INTO table_name VALUES value1,value2" << endl;
+        cerr << "Invalid INSERT command. Usage: INSERT INTO table_name VALUES (value1, value2)[, (value3, value4) ...]" << endl;
         return 1;
     }
 
     string table_name = tokens[2];
-    load_table(data_dir, table_name); // Загружаем таблицу
-
-    // Проверяем что таблица загрузилась
-    Table* table = reinterpret_cast<Table*>(tables.get(table_name));
+    // Загружаем таблицу и проверяем что она загрузилась
+    Table* table = find_or_load_table_shared(data_dir, table_name);
     if (!table) {
         return 1;
     }
@@ -1194,6 +5420,22 @@ int main(int argc, char* argv[]) {
         return 1;
     }
 
+    // Несколько строк за раз: VALUES (v1, v2), (v3, v4)
+    CustVector<CustVector<string>> value_rows;
+    size_t values_pos = query.find("VALUES", query.find(table_name) + table_name.size());
+    if (values_pos != string::npos && parse_value_tuples(query.substr(values_pos + 6), value_rows)) {
+        for (size_t r = 0; r < value_rows.size; ++r) {
+            if (value_rows[r].size != table->columns.size - 1) {
+                cerr << "Error: Expected " << table->columns.size - 1 << " values, but got "
+                     << value_rows[r].size << " in row " << r + 1 << endl;
+                return 1;
+            }
+        }
+        size_t requested = value_rows.size;
+        report_inserted(insert_rows(data_dir, table_name, value_rows), requested);
+        return 0;
+    }
+
     CustVector<string> values;
     for (size_t i = 4; i < tokens.size; ++i) {
         values.push_back(trim(tokens[i]));
@@ -1220,7 +5462,7 @@ int main(int argc, char* argv[]) {
         }
         
         string table_name = tokens[2];
-        load_table(data_dir, table_name);
+        find_or_load_table_shared(data_dir, table_name);
         
         string condition;
         for (size_t i = 4; i < tokens.size; ++i) {
@@ -1230,6 +5472,48 @@ int main(int argc, char* argv[]) {
         
         delete_data(data_dir, table_name, condition);
     }
+    else if (command == "CREATE" && tokens.size > 1 && tokens[1] == "INDEX") {
+        // CREATE INDEX name ON table(column) [USING HASH|SORTED]
+        if (tokens.size < 5 || tokens[3] != "ON") {
+            cerr << "Invalid CREATE INDEX command. Usage: CREATE INDEX index_name ON table_name(column) [USING HASH|SORTED]" << endl;
+            return 1;
+        }
+
+        string index_name = tokens[2];
+        string table_name;
+        string column_name;
+        size_t next_token = 5;
+        size_t bracket_pos = tokens[4].find('(');
+        if (bracket_pos != string::npos) {
+            table_name = tokens[4].substr(0, bracket_pos);
+            column_name = tokens[4].substr(bracket_pos + 1, tokens[4].size() - bracket_pos - 2);
+        } else if (tokens.size > 5) {
+            table_name = tokens[4];
+            column_name = tokens[5];
+            next_token = 6;
+        }
+        table_name = trim(table_name);
+        column_name = trim(column_name);
+
+        bool sorted = false;
+        if (next_token < tokens.size) {
+            if (next_token + 2 != tokens.size || tokens[next_token] != "USING" ||
+                (tokens[next_token + 1] != "HASH" && tokens[next_token + 1] != "SORTED")) {
+                cerr << "Invalid CREATE INDEX command. Usage: CREATE INDEX index_name ON table_name(column) [USING HASH|SORTED]" << endl;
+                return 1;
+            }
+            sorted = tokens[next_token + 1] == "SORTED";
+        }
+        if (table_name.empty() || column_name.empty()) {
+            cerr << "Invalid CREATE INDEX command. Usage: CREATE INDEX index_name ON table_name(column) [USING HASH|SORTED]" << endl;
+            return 1;
+        }
+
+        if (!find_or_load_table_shared(data_dir, table_name)) {
+            return 1;
+        }
+        create_index(data_dir, index_name, table_name, column_name, sorted);
+    }
     else if (command == "CREATE") {
         if (tokens.size < 6 || tokens[1] != "TABLE" || tokens[tokens.size - 2] != "PRIMARY_KEY") {
             cerr << "Invalid CREATE TABLE command. Usage: CREATE TABLE table_name (column1,column2) PRIMARY_KEY primary_key" << endl;
@@ -1257,27 +5541,66 @@ int main(int argc, char* argv[]) {
         
         create_table(data_dir, table_name, columns, primary_key);
     }
+    else if (command == "COMPACT") {
+        if (tokens.size != 2) {
+            cerr << "Invalid COMPACT command. Usage: COMPACT table_name" << endl;
+            return 1;
+        }
+
+        string table_name = tokens[1];
+        if (!find_or_load_table_shared(data_dir, table_name)) {
+            return 1;
+        }
+        compact_data(data_dir, table_name);
+    }
+    else if (command == "VACUUM") {
+        if (tokens.size != 2) {
+            cerr << "Invalid VACUUM command. Usage: VACUUM table_name" << endl;
+            return 1;
+        }
+
+        string table_name = tokens[1];
+        if (!find_or_load_table_shared(data_dir, table_name)) {
+            return 1;
+        }
+        vacuum_data(data_dir, table_name);
+    }
+    else if (command == "COPY") {
+        size_t from_pos = query.find("FROM");
+        if (tokens.size < 4 || tokens[2] != "FROM" || from_pos == string::npos) {
+            cerr << "Invalid COPY command. Usage: COPY table_name FROM 'file.csv'" << endl;
+            return 1;
+        }
+
+        // Путь берём из исходной строки, чтобы не потерять пробелы в нём
+        string path = trim(query.substr(from_pos + 4));
+        if (path.size() >= 2 && (path.front() == '\'' || path.front() == '"') && path.back() == path.front()) {
+            path = path.substr(1, path.size() - 2);
+        }
+        copy_from_csv(data_dir, tokens[1], path);
+    }
     else if (command == "SAVE") {
     if (tokens.size == 3) {
         string format = tokens[1];
         string table_name = tokens[2];
         
-        Table* table = reinterpret_cast<Table*>(tables.get(table_name));
-
-        // Загружаем таблицу чтобы получить актуальные данные
-        load_table(data_dir, table_name);
-        table = reinterpret_cast<Table*>(tables.get(table_name));
+        // Загружаем таблицу, если её ещё нет в памяти
+        if (!find_or_load_table_shared(data_dir, table_name)) {
+            return 1;
+        }
 
         if (format == "CSV") {
-            save_as_csv(data_dir, table_name, *table);
+            save_as_csv(data_dir, table_name);
         } else if (format == "JSON") {
-            save_as_json(data_dir, table_name, *table);
+            save_as_json(data_dir, table_name);
+        } else if (format == "BINARY") {
+            save_as_binary(data_dir, table_name);
         } else {
-            cerr << "Invalid format: " << format << ". Use CSV or JSON" << endl;
+            cerr << "Invalid format: " << format << ". Use CSV, JSON or BINARY" << endl;
             return 1;
         }
     } else {
-        cerr << "Invalid SAVE command. Usage: SAVE CSV table_name or SAVE JSON table_name" << endl;
+        cerr << "Invalid SAVE command. Usage: SAVE CSV|JSON|BINARY table_name" << endl;
         return 1;
     }
 }
@@ -1290,4 +5613,538 @@ catch (const exception& e) {
     cerr << "Error: " << e.what() << endl;
     return 1;
 }
+    return 0;
+}
+
+// Печать профиля запроса: время, число замеров и строки на входе и выходе каждого этапа
+void print_profile(ostream& out, const QueryProfile& profile, uint64_t total_nanos) {
+    char line[160];
+    snprintf(line, sizeof(line), "%-14s %12s %8s %12s %12s\n", "stage", "time_ms", "calls", "rows_in", "rows_out");
+    out << line;
+    for (size_t stage = 0; stage < STAGE_COUNT; ++stage) {
+        if (profile.calls[stage] == 0) continue;
+        snprintf(line, sizeof(line), "%-14s %12.3f %8zu %12zu %12zu\n", PROFILE_STAGE_NAMES[stage],
+                 profile.nanos[stage] / 1e6, profile.calls[stage], profile.rows_in[stage], profile.rows_out[stage]);
+        out << line;
+    }
+    snprintf(line, sizeof(line), "%-14s %12.3f\n", "total", total_nanos / 1e6);
+    out << line;
+    out.flush();
+}
+
+// Выполнение запроса с профилированием по запросу: префикс EXPLAIN ANALYZE
+// печатает разбивку по этапам после результата, флаг --profile - в поток ошибок
+int execute_query(const string& data_dir, const string& query) {
+    string body = query;
+    bool explain = false;
+    istringstream words(query);
+    string first_word, second_word;
+    if (words >> first_word >> second_word && first_word == "EXPLAIN" && second_word == "ANALYZE") {
+        explain = true;
+        getline(words, body);
+        body = trim(body);
+    }
+    if (!explain && !profile_queries) {
+        return run_query(data_dir, body);
+    }
+
+    QueryProfile profile;
+    current_profile = &profile;
+    auto start = chrono::steady_clock::now();
+    int status = run_query(data_dir, body);
+    uint64_t total_nanos = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+    current_profile = nullptr;
+    print_profile(explain ? cout : cerr, profile, total_nanos);
+    return status;
+}
+
+// Буфер потока вывода поверх файлового дескриптора (для клиентов сокета)
+class FdStreamBuf : public streambuf {
+public:
+    explicit FdStreamBuf(int fd) : fd_(fd) {
+        setp(buffer_, buffer_ + sizeof(buffer_));
+    }
+
+    ~FdStreamBuf() override {
+        sync();
+    }
+
+protected:
+    int overflow(int ch) override {
+        if (sync() != 0) return EOF;
+        if (ch != EOF) {
+            *pptr() = static_cast<char>(ch);
+            pbump(1);
+        }
+        return ch == EOF ? 0 : ch;
+    }
+
+    int sync() override {
+        const char* begin = pbase();
+        while (begin < pptr()) {
+            ssize_t written = ::write(fd_, begin, pptr() - begin);
+            if (written <= 0) {
+                setp(buffer_, buffer_ + sizeof(buffer_));
+                return -1;
+            }
+            begin += written;
+        }
+        setp(buffer_, buffer_ + sizeof(buffer_));
+        return 0;
+    }
+
+private:
+    int fd_;
+    char buffer_[65536];
+};
+
+// Чтение строки из файлового дескриптора с буферизацией
+bool read_line_fd(int fd, string& buffer, string& line) {
+    while (true) {
+        size_t newline = buffer.find('\n');
+        if (newline != string::npos) {
+            line = buffer.substr(0, newline);
+            buffer.erase(0, newline + 1);
+            if (!line.empty() && line.back() == '\r') line.pop_back();
+            return true;
+        }
+        char chunk[4096];
+        ssize_t received = ::read(fd, chunk, sizeof(chunk));
+        if (received <= 0) {
+            if (buffer.empty()) return false;
+            line = buffer;
+            buffer.clear();
+            return true;
+        }
+        buffer.append(chunk, received);
+    }
+}
+
+// Обработка запросов одного клиента: одна строка - один запрос.
+// Ответ на каждый запрос завершается строкой "#END <код>"
+void serve_queries(const string& data_dir, int in_fd) {
+    string buffer;
+    string line;
+    while (read_line_fd(in_fd, buffer, line)) {
+        line = trim(line);
+        if (line.empty()) continue;
+        if (line == "QUIT" || line == "EXIT") break;
+        int status = execute_query(data_dir, line);
+        cerr.flush();
+        cout << "#END " << status << "\n";
+        cout.flush();
+    }
+}
+
+// Сервер на Unix domain socket: клиенты обслуживаются по очереди
+int serve_socket(const string& data_dir, const string& socket_path) {
+    int server_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (server_fd < 0) {
+        cerr << "Error: Failed to create socket" << endl;
+        return 1;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(address.sun_path)) {
+        cerr << "Error: Socket path is too long: " << socket_path << endl;
+        close(server_fd);
+        return 1;
+    }
+    strcpy(address.sun_path, socket_path.c_str());
+    unlink(socket_path.c_str());
+
+    if (bind(server_fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || listen(server_fd, 16) < 0) {
+        cerr << "Error: Failed to listen on socket: " << socket_path << endl;
+        close(server_fd);
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    cerr << "Listening on " << socket_path << endl;
+
+    while (true) {
+        int client_fd = accept(server_fd, nullptr, nullptr);
+        if (client_fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        // Весь вывод запросов (и ошибки тоже) уходит клиенту
+        FdStreamBuf client_buf(client_fd);
+        streambuf* old_cout = cout.rdbuf(&client_buf);
+        streambuf* old_cerr = cerr.rdbuf(&client_buf);
+        serve_queries(data_dir, client_fd);
+        cout.rdbuf(old_cout);
+        cerr.rdbuf(old_cerr);
+        client_buf.pubsync();
+        close(client_fd);
+    }
+
+    close(server_fd);
+    unlink(socket_path.c_str());
+    return 0;
+}
+
+// Нагрузочные замеры (--benchmark). Во временной поддиректории каталога данных
+// генерируются синтетические таблицы, затем замеряются загрузка, вставка, удаление,
+// выборка и соединение. Результат - по одному JSON-объекту на замер
+struct BenchmarkOptions {
+    size_t rows;  // Строк в основной таблице
+    CustVector<ColumnType> column_types;  // Типы генерируемых столбцов (кроме ключа)
+    size_t repeat;  // Повторов для загрузки и выборки
+    size_t write_ops;  // Число отдельных вставок и удалений
+
+    BenchmarkOptions() : rows(100000), repeat(5), write_ops(1000) {}
+};
+
+// Поток, отбрасывающий весь вывод (сообщения замеряемых функций)
+class NullStreamBuf : public streambuf {
+protected:
+    int overflow(int ch) override {
+        return ch == EOF ? 0 : ch;
+    }
+    streamsize xsputn(const char*, streamsize count) override {
+        return count;
+    }
+};
+
+size_t peak_rss_kb() {
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<size_t>(usage.ru_maxrss);
+}
+
+// Значение перцентиля по отсортированным длительностям
+double percentile(const CustVector<double>& sorted, double fraction) {
+    if (sorted.size == 0) return 0;
+    size_t index = static_cast<size_t>(fraction * (sorted.size - 1) + 0.5);
+    return sorted[index];
+}
+
+// Запись одного замера: rows_per_sec считается по rows_per_op строк на операцию
+void report_benchmark(ostream& out, const string& name, CustVector<double>& latencies_ms, size_t rows_per_op) {
+    sort(latencies_ms.data, latencies_ms.data + latencies_ms.size);
+    double total_ms = 0;
+    for (size_t i = 0; i < latencies_ms.size; ++i) {
+        total_ms += latencies_ms[i];
+    }
+    double rows_per_sec = total_ms > 0 ? rows_per_op * latencies_ms.size * 1000.0 / total_ms : 0;
+
+    string line = "{\"benchmark\":";
+    append_json_string(line, name);
+    char numbers[512];
+    snprintf(numbers, sizeof(numbers),
+             ",\"ops\":%zu,\"rows_per_op\":%zu,\"rows_per_sec\":%.1f,\"p50_ms\":%.4f,\"p90_ms\":%.4f,"
+             "\"p99_ms\":%.4f,\"max_ms\":%.4f,\"peak_rss_kb\":%zu}\n",
+             latencies_ms.size, rows_per_op, rows_per_sec, percentile(latencies_ms, 0.5),
+             percentile(latencies_ms, 0.9), percentile(latencies_ms, 0.99),
+             latencies_ms.size ? latencies_ms[latencies_ms.size - 1] : 0.0, peak_rss_kb());
+    line += numbers;
+    out << line;
+    out.flush();
+}
+
+// Длительность вызова в миллисекундах
+template<typename Func>
+double time_ms(Func&& func) {
+    auto start = chrono::steady_clock::now();
+    func();
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+}
+
+// Синтетическая таблица: ключ id, столбцы c1..cN заданных типов и столбец ref
+// со ссылкой на строку таблицы из ref_rows строк (для соединения)
+Table* generate_benchmark_table(const string& name, size_t row_count, const CustVector<ColumnType>& types,
+                                size_t ref_rows, mt19937_64& random) {
+    static const char* const type_names[] = {"INT", "DOUBLE", "STRING"};
+    Table* table = new Table(name);
+    table->primary_key = "id";
+    table->columns.push_back("id");
+    table->column_types.push_back("INT");
+    for (size_t c = 0; c < types.size; ++c) {
+        table->columns.push_back("c" + to_string(c + 1));
+        table->column_types.push_back(type_names[types[c]]);
+    }
+    table->columns.push_back("ref");
+    table->column_types.push_back("INT");
+
+    uniform_int_distribution<int64_t> ints(0, static_cast<int64_t>(row_count));
+    uniform_real_distribution<double> doubles(0, 1000);
+    uniform_int_distribution<size_t> words(0, 999);
+    uniform_int_distribution<size_t> refs(1, ref_rows > 0 ? ref_rows : 1);
+    table->rows.reserve(row_count);
+    for (size_t i = 0; i < row_count; ++i) {
+        CustVector<string>& row = append_row(table);
+        row.push_back(to_string(i + 1));
+        for (size_t c = 0; c < types.size; ++c) {
+            if (types[c] == COLUMN_INT) {
+                row.push_back(to_string(ints(random)));
+            } else if (types[c] == COLUMN_DOUBLE) {
+                char buffer[32];
+                snprintf(buffer, sizeof(buffer), "%.3f", doubles(random));
+                row.push_back(buffer);
+            } else {
+                row.push_back("word" + to_string(words(random)));
+            }
+        }
+        row.push_back(to_string(refs(random)));
+    }
+    table->pk_sequence = row_count;
+    return table;
+}
+
+// Запись таблицы в файл заданного формата вместе со служебными файлами
+void write_benchmark_table(const string& data_dir, Table& table, const string& format) {
+    table.file_format = format;
+    persist_table(data_dir, table);
+    write_pk_sequence(data_dir, table.name, table.pk_sequence);
+}
+
+// Замер загрузки: таблица каждый раз читается с диска заново
+void benchmark_load(ostream& out, const string& bench_dir, const string& name, const string& table_name,
+                    void (*loader)(const string&, const string&, const CustVector<string>*),
+                    const BenchmarkOptions& options) {
+    CustVector<double> latencies;
+    for (size_t r = 0; r < options.repeat; ++r) {
+        tables.erase(table_name);
+        latencies.push_back(time_ms([&]() { loader(bench_dir, table_name, nullptr); }));
+    }
+    report_benchmark(out, name, latencies, options.rows);
+}
+
+// Замер выборки: вывод результата идёт в отбрасывающий поток, как и у остальных замеров
+void benchmark_select(ostream& out, const string& bench_dir, const string& name, const CustVector<string>& table_names,
+                      const CustVector<string>& columns, const string& condition, size_t rows_per_op,
+                      const BenchmarkOptions& options) {
+    CustVector<double> latencies;
+    for (size_t r = 0; r < options.repeat; ++r) {
+        latencies.push_back(time_ms([&]() { select_data(bench_dir, table_names, columns, condition); }));
+    }
+    report_benchmark(out, name, latencies, rows_per_op);
+}
+
+int run_benchmarks(const string& data_dir, const BenchmarkOptions& options) {
+    string bench_dir = (fs::path(data_dir) / ("_bench_" + to_string(getpid()))).string();
+    fs::create_directories(bench_dir);
+    ostream out(cout.rdbuf());
+    NullStreamBuf null_buf;
+    streambuf* old_cout = cout.rdbuf(&null_buf);
+
+    mt19937_64 random(42);
+    size_t join_rows = max<size_t>(1, options.rows / 10);
+    Table* main_table = generate_benchmark_table("bench_json", options.rows, options.column_types, join_rows, random);
+    Table* join_table = generate_benchmark_table("bench_join", join_rows, options.column_types, join_rows, random);
+    write_benchmark_table(bench_dir, *main_table, "json");
+    main_table->name = "bench_csv";
+    write_benchmark_table(bench_dir, *main_table, "csv");
+    main_table->name = "bench_bin";
+    write_benchmark_table(bench_dir, *main_table, "bin");
+    write_benchmark_table(bench_dir, *join_table, "json");
+    delete main_table;
+    delete join_table;
+
+    benchmark_load(out, bench_dir, "load_table_json", "bench_json", load_table_json, options);
+    benchmark_load(out, bench_dir, "load_table_csv", "bench_csv", load_table_csv, options);
+    benchmark_load(out, bench_dir, "load_table_binary", "bench_bin", load_table_binary, options);
+    load_table(bench_dir, "bench_join");
+
+    // Выборки по таблице после полной загрузки (колонки и индекс ключа построены)
+    tables.erase("bench_json");
+    load_table(bench_dir, "bench_json");
+    CustVector<string> main_name;
+    main_name.push_back("bench_json");
+    CustVector<string> all_columns;
+    all_columns.push_back("*");
+    CustVector<string> key_column;
+    key_column.push_back("bench_json.id");
+    string mid_key = to_string(options.rows / 2 + 1);
+    benchmark_select(out, bench_dir, "select_full_scan", main_name, all_columns, "", options.rows, options);
+    benchmark_select(out, bench_dir, "select_pk_equal", main_name, key_column, "bench_json.id = " + mid_key, 1, options);
+    benchmark_select(out, bench_dir, "select_range", main_name, key_column, "bench_json.ref < " + to_string(join_rows / 10 + 1),
+                     options.rows, options);
+    for (size_t c = 0; c < options.column_types.size; ++c) {
+        string column = "bench_json.c" + to_string(c + 1);
+        string literal = options.column_types[c] == COLUMN_STRING ? "'word7'" : "500";
+        string op = options.column_types[c] == COLUMN_STRING ? " = " : " < ";
+        string shape = options.column_types[c] == COLUMN_STRING ? "string_equal" : "numeric_compare";
+        benchmark_select(out, bench_dir, "select_" + shape + "_c" + to_string(c + 1), main_name, key_column,
+                         column + op + literal, options.rows, options);
+    }
+    benchmark_select(out, bench_dir, "select_and_or", main_name, key_column,
+                     "bench_json.ref < 10 AND bench_json.id > " + mid_key + " OR bench_json.id = 1", options.rows, options);
+
+    CustVector<string> join_names;
+    join_names.push_back("bench_json");
+    join_names.push_back("bench_join");
+    benchmark_select(out, bench_dir, "select_join", join_names, all_columns, "bench_json.ref = bench_join.id",
+                     options.rows, options);
+
+    // Вставки и удаления - отдельными операциями, как отдельные запросы
+    CustVector<string> values;
+    for (size_t c = 0; c < options.column_types.size; ++c) {
+        values.push_back(options.column_types[c] == COLUMN_STRING ? "inserted" : "1");
+    }
+    values.push_back("1");
+    CustVector<double> latencies;
+    for (size_t i = 0; i < options.write_ops; ++i) {
+        latencies.push_back(time_ms([&]() { insert_data(bench_dir, "bench_json", values); }));
+    }
+    report_benchmark(out, "insert_data", latencies, 1);
+
+    latencies = CustVector<double>();
+    for (size_t i = 0; i < options.write_ops && i < options.rows; ++i) {
+        string condition = "bench_json.id = " + to_string(i * (options.rows / options.write_ops) + 1);
+        latencies.push_back(time_ms([&]() { delete_data(bench_dir, "bench_json", condition); }));
+    }
+    report_benchmark(out, "delete_data_point", latencies, 1);
+
+    latencies = CustVector<double>();
+    latencies.push_back(time_ms([&]() { delete_data(bench_dir, "bench_json", "bench_json.ref < " + to_string(join_rows / 2 + 1)); }));
+    report_benchmark(out, "delete_data_range", latencies, options.rows);
+
+    cout.rdbuf(old_cout);
+    fs::remove_all(bench_dir);
+    return 0;
+}
+
+// Положительное целое из аргумента командной строки
+bool parse_count(const string& text, size_t& value) {
+    if (text.empty() || text.size() > 18 || !all_of(text.begin(), text.end(), ::isdigit) || stoull(text) == 0) {
+        return false;
+    }
+    value = stoull(text);
+    return true;
+}
+
+int main(int argc, char* argv[]) {
+    string data_dir;
+    string query;
+    string socket_path;
+    bool has_query = false;
+    bool serve = false;
+    bool benchmark = false;
+    BenchmarkOptions bench_options;
+
+    for (int i = 1; i < argc; ++i) {
+        string arg = argv[i];
+        if (arg == "--file" && i + 1 < argc) {
+            data_dir = argv[++i];
+        } else if (arg == "--query" && i + 1 < argc) {
+            query = argv[++i];
+            has_query = true;
+        } else if (arg == "--fsync" && i + 1 < argc) {
+            // Политика fsync журнала: always, never или число вставок между fsync
+            string policy = argv[++i];
+            if (policy == "always") {
+                wal_sync_policy = WAL_SYNC_ALWAYS;
+            } else if (policy == "never") {
+                wal_sync_policy = WAL_SYNC_NEVER;
+            } else if (!policy.empty() && all_of(policy.begin(), policy.end(), ::isdigit) && stoul(policy) > 0) {
+                wal_sync_policy = WAL_SYNC_INTERVAL;
+                wal_sync_interval = stoul(policy);
+            } else {
+                cerr << "Error: Invalid fsync policy: " << policy << " (use always, never or a number)" << endl;
+                return 1;
+            }
+        } else if (arg == "--threads" && i + 1 < argc) {
+            // Число потоков для просмотра таблиц в SELECT и DELETE
+            string count = argv[++i];
+            if (count.empty() || !all_of(count.begin(), count.end(), ::isdigit) || stoul(count) == 0) {
+                cerr << "Error: Invalid thread count: " << count << endl;
+                return 1;
+            }
+            scan_threads = stoul(count);
+        } else if (arg == "--format" && i + 1 < argc) {
+            // Формат вывода результатов SELECT
+            string format = argv[++i];
+            if (format == "tsv") {
+                output_format = OUTPUT_TSV;
+            } else if (format == "csv") {
+                output_format = OUTPUT_CSV;
+            } else if (format == "jsonl") {
+                output_format = OUTPUT_JSONL;
+            } else {
+                cerr << "Error: Invalid output format: " << format << " (use tsv, csv or jsonl)" << endl;
+                return 1;
+            }
+        } else if (arg == "--compact-json") {
+            json_compact_output = true;
+        } else if (arg == "--cache-mb" && i + 1 < argc) {
+            // Бюджет памяти для таблиц в мегабайтах
+            size_t megabytes;
+            if (!parse_count(argv[++i], megabytes)) {
+                cerr << "Error: Invalid cache size: " << argv[i] << endl;
+                return 1;
+            }
+            table_cache.budget_bytes = megabytes << 20;
+        } else if (arg == "--profile") {
+            profile_queries = true;
+        } else if (arg == "--benchmark") {
+            benchmark = true;
+        } else if ((arg == "--bench-rows" || arg == "--bench-repeat" || arg == "--bench-ops") && i + 1 < argc) {
+            size_t& target = arg == "--bench-rows" ? bench_options.rows
+                           : arg == "--bench-repeat" ? bench_options.repeat : bench_options.write_ops;
+            if (!parse_count(argv[++i], target)) {
+                cerr << "Error: Invalid value for " << arg << ": " << argv[i] << endl;
+                return 1;
+            }
+        } else if (arg == "--bench-columns" && i + 1 < argc) {
+            // Типы генерируемых столбцов через запятую: int,double,string
+            istringstream types_stream(argv[++i]);
+            string type_name;
+            while (getline(types_stream, type_name, ',')) {
+                transform(type_name.begin(), type_name.end(), type_name.begin(), ::toupper);
+                ColumnType type;
+                if (!column_type_from_name(trim(type_name), type)) {
+                    cerr << "Error: Invalid benchmark column type: " << type_name << " (use int, double or string)" << endl;
+                    return 1;
+                }
+                bench_options.column_types.push_back(type);
+            }
+        } else if (arg == "--serve") {
+            serve = true;
+        } else if (arg == "--socket" && i + 1 < argc) {
+            socket_path = argv[++i];
+            serve = true;
+        } else {
+            data_dir.clear();
+            break;
+        }
+    }
+
+    // Проверка формата команды
+    if (data_dir.empty() || has_query + serve + benchmark != 1) {
+        cerr << "Usage: " << argv[0] << " --file <data_directory> [--fsync always|never|N] [--compact-json] [--threads N] [--format tsv|csv|jsonl] [--profile] --query '<SQL_command>'" << endl;
+        cerr << "       " << argv[0] << " --file <data_directory> [--fsync always|never|N] [--compact-json] [--threads N] [--format tsv|csv|jsonl] [--profile] [--cache-mb N] --serve [--socket <path>]" << endl;
+        cerr << "       " << argv[0] << " --file <data_directory> [--fsync always|never|N] [--threads N] --benchmark [--bench-rows N] [--bench-columns int,double,string] [--bench-repeat N] [--bench-ops N]" << endl;
+        return 1;
+    }
+
+    // Проверяем существование директории
+    if (!fs::exists(data_dir) || !fs::is_directory(data_dir)) {
+        cerr << "Error: Directory not found: " << data_dir << endl;
+        return 1;
+    }
+
+    if (benchmark) {
+        if (bench_options.column_types.size == 0) {
+            bench_options.column_types.push_back(COLUMN_INT);
+            bench_options.column_types.push_back(COLUMN_DOUBLE);
+            bench_options.column_types.push_back(COLUMN_STRING);
+        }
+        return run_benchmarks(data_dir, bench_options);
+    }
+
+    if (!serve) {
+        return execute_query(data_dir, query);
+    }
+
+    // Режим сервера: таблицы загружаются один раз и остаются в памяти
+    load_resident_tables(data_dir);
+    if (!socket_path.empty()) {
+        return serve_socket(data_dir, socket_path);
+    }
+    serve_queries(data_dir, STDIN_FILENO);
+    return 0;
 }